@@ -4,58 +4,644 @@
  * 
  * A library for doing arithmetic with arbitrarily large integers (positive integers
  * only).
+ *
+ * Thread safety: the library has no mutable state shared between threads other
+ * than its configuration (allocation functions, thresholds, thread counts) and
+ * the worker pools of contexts, which are guarded by locks. Everything it caches
+ * to speed operations up (free lists, arena chunks, radix conversion powers) is
+ * kept per thread in `pool`, and the divisor and Montgomery objects are never
+ * modified after they are created.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "big_numbers.h"
 
-#define BLOCK_SIZE 32
-#define BLOCK_MASK 4294967295 // 2^32 - 1
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+#define BLOCK_SIZE BNUM_BLOCK_BITS
+#define BLOCK_MASK ((Block) -1) // 2^BLOCK_SIZE - 1
+
+// DBlock - "double block". Wide enough to hold the full product of two blocks,
+// plus two more blocks worth of carries.
+#if BLOCK_SIZE == 64
+#if !defined(__SIZEOF_INT128__)
+#error "64-bit blocks need a compiler with unsigned __int128; build with BNUM_BLOCK_BITS=32"
+#endif
+typedef unsigned __int128 DBlock;
+#else
+typedef uint64_t DBlock;
+#endif
+
+#define POW_WINDOW_MAX 4 // largest window used by `Bnum_pow()`, in bits
+#define POWMOD_WINDOW_MAX 6 // largest window used by `Bnum_powmod()`, in bits
+
+// Memory pool parameters. Allocations of up to 2^POOL_MAX_LOG bytes are rounded
+// up to a power of two and recycled through per-thread free lists, which keep at
+// most POOL_MAX_FREE buffers per size.
+#define POOL_MIN_LOG 4
+#define POOL_MAX_LOG 16
+#define POOL_CLASSES (POOL_MAX_LOG - POOL_MIN_LOG + 1)
+#define POOL_MAX_FREE 64
+
+// Arena parameters. Arenas hand out memory from chunks of ARENA_CHUNK_SIZE bytes
+// (or a dedicated chunk for larger requests); up to ARENA_MAX_SPARE chunks per
+// thread are kept for the next arena instead of being freed.
+#define ARENA_CHUNK_SIZE 65536
+#define ARENA_MAX_SPARE 4
+#define ARENA_ALIGN 16
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+// Default tuning thresholds, in blocks. These can be overridden at build time, or
+// at run time with `Bnum_set_threshold()`.
+
+#ifndef KARATSUBA_THRESHOLD
+#define KARATSUBA_THRESHOLD 32
+#endif
+#ifndef TOOM33_THRESHOLD
+#define TOOM33_THRESHOLD 150
+#endif
+#ifndef TOOM32_THRESHOLD
+#define TOOM32_THRESHOLD 100
+#endif
+#ifndef SQR_KARATSUBA_THRESHOLD
+#define SQR_KARATSUBA_THRESHOLD 48
+#endif
+#ifndef SQR_TOOM3_THRESHOLD
+#define SQR_TOOM3_THRESHOLD 250
+#endif
+#ifndef NTT_THRESHOLD
+#define NTT_THRESHOLD 10000
+#endif
+#ifndef DC_DIV_THRESHOLD
+#define DC_DIV_THRESHOLD 50
+#endif
+#ifndef NEWTON_DIV_THRESHOLD
+#define NEWTON_DIV_THRESHOLD 10000
+#endif
+#ifndef DIVISOR_NEWTON_THRESHOLD
+#define DIVISOR_NEWTON_THRESHOLD 600
+#endif
+#ifndef TO_STR_THRESHOLD
+#define TO_STR_THRESHOLD 30
+#endif
+#ifndef FROM_STR_THRESHOLD
+#define FROM_STR_THRESHOLD 30
+#endif
+#ifndef PARALLEL_THRESHOLD
+#define PARALLEL_THRESHOLD 2000
+#endif
+
+static const int min_thresholds[BNUM_NUM_THRESHOLDS] = {
+    [BNUM_KARATSUBA_THRESHOLD] = 2,
+    [BNUM_TOOM33_THRESHOLD] = 9,
+    [BNUM_TOOM32_THRESHOLD] = 9,
+    [BNUM_SQR_KARATSUBA_THRESHOLD] = 2,
+    [BNUM_SQR_TOOM3_THRESHOLD] = 9,
+    [BNUM_NTT_THRESHOLD] = 2,
+    [BNUM_DC_DIV_THRESHOLD] = 4,
+    [BNUM_NEWTON_DIV_THRESHOLD] = 4,
+    [BNUM_DIVISOR_NEWTON_THRESHOLD] = 2,
+    [BNUM_TO_STR_THRESHOLD] = 2,
+    [BNUM_FROM_STR_THRESHOLD] = 2,
+    [BNUM_PARALLEL_THRESHOLD] = 2,
+};
+
+// Digits of bases up to 36, for `Bnum_to_str()`; `Bnum_from_str()` also accepts
+// uppercase letters.
+static const char digit_chars[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+// Value of each character as a digit, or 36 for characters that aren't digits of
+// any base, see `digit_value()`.
+static const unsigned char digit_values[256] = {
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 36, 36, 36, 36, 36, 36,
+    36, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24,
+    25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 36, 36, 36, 36,
+    36, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24,
+    25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+};
+
+// A buffer sitting in one of the pool's free lists.
+typedef struct FreeBuffer {
+    struct FreeBuffer* next;
+} FreeBuffer;
+
+// A chunk of memory belonging to an arena; its usable space follows the header.
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t size;    // total size, including this header
+} ArenaChunk;
+
+struct Bnum_arena {
+    ArenaChunk* chunks;     // all chunks of the arena, most recent first
+    char* next;             // free space in the current chunk
+    char* end;
+    Bnum_arena* parent;     // arena that was current before this one began
+};
+
+struct Bnum_divisor {
+    int num_blocks;     // number of blocks of the divisor
+    int shift;          // left shift that sets the divisor's most significant bit
+    Block inverse;      // `invert_limb()` or `invert_3by2()` of the top of `d`
+    Block* d;           // the divisor, shifted left by `shift` bits
+    Block* x;           // reciprocal of `d` from `blocks_invert()`, or NULL if `d`
+                        // is too short for it to be worthwhile
+};
+
+struct Bnum_mont_ctx {
+    int num_blocks;     // number of blocks of the modulus
+    Block minv;         // `-1 / m mod B`, where B is the block base
+    Block* m;           // the modulus
+    Block* r2;          // `R^2 mod m`, where `R = B^num_blocks`
+};
+
+// Maximum number of levels in a `PowerTower`; level i has about 2^i blocks.
+#define TOWER_MAX_LEVELS 40
+
+// A power of the base used for radix conversion, `base^digits`.
+typedef struct StrPower {
+    Block* blocks;
+    int num_blocks;
+    size_t digits;
+} StrPower;
+
+// Powers of a base used to split numbers for radix conversion, see `power_tower()`.
+typedef struct PowerTower {
+    int base;
+    int chunk_digits;           // number of digits of the base that fit in a block
+    Block chunk;                // base^chunk_digits, shifted left by `chunk_shift`
+    int chunk_shift;            // left shift that sets the most significant bit of `chunk`
+    Block chunk_inverse;        // `invert_limb()` of `chunk`
+    int num_levels;
+    StrPower powers[TOWER_MAX_LEVELS];  // level i is (base^chunk_digits)^(2^i)
+} PowerTower;
+
+// Binary format written by `Bnum_write()`: a header of FILE_HEADER_SIZE bytes,
+//   bytes 0-3   the magic string "BNUM"
+//   byte 4      the format version, FILE_VERSION
+//   byte 5      the width of a block in bits, 32 or 64
+//   byte 6      the byte order of the blocks and the length, 0 little endian, 1 big
+//   byte 7      zero
+//   bytes 8-15  the number of blocks, as a 64-bit integer
+// followed by the blocks, least significant first. The header keeps the blocks
+// aligned, so a file written on the same kind of machine can be mapped directly.
+#define FILE_MAGIC "BNUM"
+#define FILE_VERSION 1
+#define FILE_HEADER_SIZE 16
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define HOST_BIG_ENDIAN 1
+#else
+#define HOST_BIG_ENDIAN 0
+#endif
+
+// Hexadecimal conversion works on 16 bytes at a time with SSSE3 shuffles when the
+// compiler targets it (e.g. with -mssse3 or -march=native). It treats the blocks
+// as one little endian byte string, which is what they are on x86.
+#if defined(__SSSE3__) && !HOST_BIG_ENDIAN
+#define HEX_SIMD 1
+#else
+#define HEX_SIMD 0
+#endif
+
+// Size of the buffer `Bnum_fprint()` and `Bnum_write_fd()` format digits into; the
+// largest the pool keeps, so that it is reused from one call to the next.
+#define STR_BUFFER_SIZE ((size_t) 1 << POOL_MAX_LOG)
+
+// Where radix conversion puts its digits. They are appended to `buf`, and when
+// `file` or `fd` is set, written out and the buffer reused whenever it fills up.
+typedef struct StrSink {
+    char* buf;
+    size_t size;    // capacity of `buf`
+    size_t len;     // number of digits in `buf`
+    FILE* file;     // stream to write to, or NULL
+    int fd;         // file descriptor to write to, or -1
+    int error;      // nonzero once writing has failed
+} StrSink;
+
+// A Bnum whose blocks are in a memory-mapped file, see `Bnum_map()`.
+typedef struct MappedBnum {
+    Bnum num;
+    void* addr;
+    size_t size;
+} MappedBnum;
+
+// Maximum number of tasks waiting in a thread's `TaskQueue`; tasks spawned while it
+// is full run right away on the spawning thread.
+#define TASK_QUEUE_SIZE 256
+
+// A piece of work that any thread working for a context can run, see
+// `task_spawn()`.
+typedef struct Task {
+    void (*run)(struct Task*);
+    Bnum_ctx* ctx;      // context the task was spawned in, and runs in
+    atomic_int done;
+} Task;
+
+// Initializer for the `Task` at the start of a task structure.
+#define TASK_INIT(run) { run, NULL, 0 }
+
+// A thread's queue of spawned tasks. Its owner adds and takes tasks at the tail,
+// newest first, while other threads steal them from the head, oldest (and
+// usually largest) first.
+typedef struct TaskQueue {
+    pthread_mutex_t lock;
+    Task* tasks[TASK_QUEUE_SIZE];
+    unsigned head;
+    unsigned tail;
+} TaskQueue;
+
+// Pool of worker threads of a context. Worker i owns queue i; queue 0 is shared by
+// all the threads outside the pool, including those of an external executor.
+typedef struct Workers {
+    int num_queues;             // worker threads plus one, or 0 if not started
+    int num_workers;            // worker threads actually running
+    pthread_t* threads;         // threads[i - 1] is worker i
+    TaskQueue* queues;
+    atomic_int next_index;      // index the next worker to start takes
+    atomic_int pending;         // number of tasks in all the queues
+    atomic_int sleeping;        // number of workers waiting for tasks
+    int stop;                   // set to make the workers exit; guarded by `sleep_lock`
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t wake;
+} Workers;
+
+struct Bnum_ctx {
+    int thresholds[BNUM_NUM_THRESHOLDS];
+    atomic_int max_threads;     // see `Bnum_ctx_create()`
+    atomic_int num_threads;     // threads splitting work once started, 1 if none
+    atomic_int started;         // whether `workers_start()` has run
+    atomic_int helpers;         // helper jobs submitted to the executor and not yet done
+    pthread_mutex_t lock;       // guards starting and stopping
+    Workers workers;
+    Bnum_submit_func submit;    // external executor, or NULL to use `workers`
+    void* submit_data;
+    Bnum_alloc_func scratch_alloc;  // see `Bnum_ctx_set_scratch_functions()`
+    Bnum_free_func scratch_free;
+};
+
+// A product computed by `mul_task_run()`.
+typedef struct MulTask {
+    Task task;
+    Block* r;
+    const Block* a;
+    int an;
+    const Block* b;
+    int bn;
+} MulTask;
+
+// Per-thread allocator state, and every other cache of the library, so that
+// threads never contend for them.
+typedef struct Pool {
+    FreeBuffer* free_lists[POOL_CLASSES];
+    int num_free[POOL_CLASSES];
+    ArenaChunk* spare_chunks;
+    int num_spare;
+    Bnum_arena* arena;      // innermost arena begun by this thread, if any
+    Bnum_alloc_stats stats;
+    int registered;         // whether `pool_thread_exit()` will run for this thread
+    PowerTower* tower;      // powers cached by `Bnum_to_str()` and `Bnum_from_str()`
+    Bnum_ctx* ctx;          // context of the operation running on this thread, if any
+} Pool;
 
-void add_block(Bnum*, uint32_t);
+static _Thread_local Pool pool;
+static pthread_key_t pool_key;
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+
+// Context of operations not given one; `Bnum_set_threshold()` and
+// `Bnum_set_max_threads()` configure it.
+static Bnum_ctx default_ctx = {
+    .thresholds = {
+        [BNUM_KARATSUBA_THRESHOLD] = KARATSUBA_THRESHOLD,
+        [BNUM_TOOM33_THRESHOLD] = TOOM33_THRESHOLD,
+        [BNUM_TOOM32_THRESHOLD] = TOOM32_THRESHOLD,
+        [BNUM_SQR_KARATSUBA_THRESHOLD] = SQR_KARATSUBA_THRESHOLD,
+        [BNUM_SQR_TOOM3_THRESHOLD] = SQR_TOOM3_THRESHOLD,
+        [BNUM_NTT_THRESHOLD] = NTT_THRESHOLD,
+        [BNUM_DC_DIV_THRESHOLD] = DC_DIV_THRESHOLD,
+        [BNUM_NEWTON_DIV_THRESHOLD] = NEWTON_DIV_THRESHOLD,
+        [BNUM_DIVISOR_NEWTON_THRESHOLD] = DIVISOR_NEWTON_THRESHOLD,
+        [BNUM_TO_STR_THRESHOLD] = TO_STR_THRESHOLD,
+        [BNUM_FROM_STR_THRESHOLD] = FROM_STR_THRESHOLD,
+        [BNUM_PARALLEL_THRESHOLD] = PARALLEL_THRESHOLD,
+    },
+    .max_threads = 1,
+    .num_threads = 1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static _Thread_local Bnum_ctx* worker_ctx;  // context whose pool the calling thread is in
+static _Thread_local int worker_index;      // its queue in that pool
+
+void add_block(Bnum*, Block);
+static void reserve_blocks(Bnum*, int);
+static Block* result_blocks(Bnum*, int*, Bnum*, Bnum*);
+static void set_result_blocks(Bnum*, Block*, int, int);
+static void normalize(Bnum*);
+static int compare(Bnum*, Bnum*);
+static void swap_buffers(Block**, int*, Block**, int*);
+
+static int pool_class(size_t);
+static void* mem_alloc(size_t);
+static void mem_free(void*, size_t);
+static void* heap_alloc(size_t);
+static void* heap_realloc(void*, size_t, size_t);
+static void heap_free(void*, size_t);
+static void* default_alloc(size_t);
+static void* default_realloc(void*, size_t, size_t);
+static void default_free(void*, size_t);
+static void pool_register(void);
+static void pool_create_key(void);
+static void pool_thread_exit(void*);
+static void* arena_alloc(Bnum_arena*, size_t);
+static ArenaChunk* arena_new_chunk(size_t);
+static Block* alloc_blocks(Bnum*, int*);
+static void free_blocks(Bnum*, Block*, int);
+static Block* temp_blocks(int);
+static void free_temp_blocks(Block*, int);
+static void* scratch_alloc(size_t);
+static void scratch_free(void*, size_t);
+
+static Bnum_ctx* current_ctx(void);
+static Bnum_ctx* ctx_enter(Bnum_ctx*);
+static int get_threshold(Bnum_threshold);
+static int use_threads(int);
+static void workers_start(Bnum_ctx*);
+static void workers_stop(Bnum_ctx*);
+static void* worker_main(void*);
+static void executor_help(void*);
+static void task_spawn(Task*);
+static void task_wait(Task*);
+static Task* task_take(Bnum_ctx*);
+static void task_run(Task*);
+static void run_tasks(Task**, int, int);
+static void mul_task_run(Task*);
+
+static Block blocks_add(Block*, const Block*, int, const Block*, int);
+static Block blocks_sub(Block*, const Block*, int, const Block*, int);
+static void blocks_neg(Block*, const Block*, int);
+static Block blocks_mul_1(Block*, const Block*, int, Block);
+static Block blocks_addmul_1(Block*, const Block*, int, Block);
+static Block blocks_submul_1(Block*, const Block*, int, Block);
+static Block blocks_add_1(Block*, const Block*, int, Block);
+static Block blocks_sub_1(Block*, const Block*, int, Block);
+static int blocks_cmp(const Block*, const Block*, int);
+static Block blocks_lshift(Block*, const Block*, int, int);
+static void blocks_rshift(Block*, const Block*, int, int);
+static void twos_rshift(Block*, const Block*, int, int);
+static void blocks_divexact_by3(Block*, const Block*, int);
+static int blocks_normalized_size(const Block*, int);
+static int block_clz(Block);
+static void blocks_mul(Block*, const Block*, int, const Block*, int);
+static void blocks_sqr(Block*, const Block*, int);
+static void blocks_mul_chunked(Block*, const Block*, int, const Block*, int, int);
+static void blocks_mul_basecase(Block*, const Block*, int, const Block*, int);
+static void blocks_sqr_basecase(Block*, const Block*, int);
+static void blocks_mul_n(Block*, const Block*, const Block*, int, Block*);
+static void karatsuba_mul(Block*, const Block*, const Block*, int, Block*);
+static int karatsuba_scratch_size(int);
+static int toom_fits(int, int, int, int);
+static void toom_mul(Block*, const Block*, int, const Block*, int, int, int);
+static int toom_eval(Block*, Block*, const Block*, int, int, int, int, Block*);
+static void blocks_divrem(Block*, Block*, const Block*, int, const Block*, int);
+static Block div_qr(Block*, Block*, int, const Block*, int);
+static Block div_qr_pi(Block*, Block*, int, const Block*, int, Block);
+static Block sb_div_qr(Block*, Block*, int, const Block*, int, Block);
+static Block dc_div_qr(Block*, Block*, int, const Block*, int, Block, Block*);
+static Block dc_div_qr_n(Block*, Block*, const Block*, int, Block, Block*);
+static Block newton_div_qr(Block*, Block*, int, const Block*, int);
+static Block reciprocal_div_qr(Block*, Block*, int, const Block*, int, const Block*);
+static void divisor_divrem(Block*, Block*, const Block*, int, const Bnum_divisor*);
+static void divmod(Bnum*, Bnum*, Bnum*, Bnum*, const Bnum_divisor*);
+static void blocks_invert(Block*, const Block*, int);
+static Block blocks_divrem_1(Block*, const Block*, int, Block);
+static Block blocks_divrem_1_pre(Block*, const Block*, int, Block, int, Block);
+static Block invert_limb(Block);
+static Block invert_3by2(Block, Block);
+static Block div_2by1(Block*, Block, Block, Block, Block);
+static Block div_3by2(Block, Block, Block, Block, Block, Block);
+static Block mont_inverse(Block);
+static void blocks_mont_mul(Block*, const Block*, const Block*, const Bnum_mont_ctx*, Block*);
+static void blocks_redc(Block*, Block*, const Bnum_mont_ctx*);
+static void load_residue(Block*, Bnum*, const Block*, int);
+static void blocks_mulmod(Block*, const Block*, const Block*, int, const Bnum_mont_ctx*,
+        const Bnum_divisor*, Block*);
+static void blocks_powmod(Block*, const Block*, const Block*, int, int,
+        const Bnum_mont_ctx*, const Bnum_divisor*);
+static PowerTower* power_tower(int, int);
+static void tower_free(PowerTower*);
+static void write_digits(StrSink*, Bnum*, int);
+static size_t blocks_to_str(StrSink*, Block*, int, size_t, const PowerTower*);
+static size_t to_str_basecase(StrSink*, Block*, int, size_t, const PowerTower*);
+static size_t to_str_pow2(char*, const Block*, int, size_t, int);
+static char* sink_reserve(StrSink*, size_t);
+static void sink_put(StrSink*, const char*, size_t);
+static void sink_flush(StrSink*);
+static int blocks_from_str(Block*, const char*, size_t, const PowerTower*);
+static int from_str_basecase(Block*, const char*, size_t, const PowerTower*);
+static int from_str_pow2(Block*, const char*, size_t, int);
+#if HEX_SIMD
+static size_t to_hex_simd(char*, const Block*, int);
+static int from_hex_simd(Block*, const char*, size_t, int*);
+#endif
+static int digits_per_block(int);
+static int digit_value(char);
+static int decode_header(const unsigned char*, int*, int*, uint64_t*);
+static void swap_bytes(unsigned char*, size_t, size_t);
+static int ntt_fits(int, int);
+static void ntt_mul(Block*, const Block*, int, const Block*, int);
+
+// Functions all memory is ultimately allocated with; see `Bnum_set_memory_functions()`.
+static Bnum_alloc_func alloc_func = default_alloc;
+static Bnum_realloc_func realloc_func = default_realloc;
+static Bnum_free_func free_func = default_free;
 
 
 /* ---------- Library Functions ---------- */
 
 /*
  * Create a Bnum, with `num` as its value. The allocated memory must be freed
- * by the caller, using `Bnum_destroy()`.
+ * by the caller, using `Bnum_destroy()`. If the calling thread has begun an
+ * arena, the Bnum belongs to it instead (see `Bnum_arena_begin()`).
  *
  * Parameters:  num     The value to initialize Bnum with.
  *
  * Returns: A pointer to the newly created Bnum.
  */
 Bnum* Bnum_create(uint64_t num) {
-    Bnum* big_num = malloc(sizeof(Bnum));
-    big_num->num_blocks = 0;
-    big_num->least_significant = NULL;
-    big_num->most_significant = NULL;
-
-    if (num == 0) { return big_num; }
-
-    for (; num > 0; num >>= BLOCK_SIZE) {
-        add_block(big_num, (uint32_t) num & BLOCK_MASK);
+    Bnum* big_num;
+    if (pool.arena) {
+        big_num = arena_alloc(pool.arena, sizeof(Bnum));
+        pool.stats.arena_allocs++;
+    }
+    else {
+        big_num = mem_alloc(sizeof(Bnum));
     }
+    // values up to 64 bits always fit inline, so this allocates nothing
+    Bnum_init(big_num, num);
+    big_num->arena = pool.arena;
 
     return big_num;
 }
 
 /*
- * Destroy a Bnum and free all of its associated memory.
+ * Destroy a Bnum and free all of its associated memory. Does nothing for Bnums
+ * that belong to an arena; their memory is freed when the arena is released.
  *
  * Parameters:  big_num     The Bnum to destroy.
  */
 void Bnum_destroy(Bnum* big_num) {
-    Block* cur = big_num->least_significant;
-    Block* prev;
-    while (cur) {
-        prev = cur;
-        cur = cur->next;
-        free(prev);
+    if (big_num->arena) { return; }
+
+    free_blocks(big_num, big_num->blocks, big_num->capacity);
+    mem_free(big_num, sizeof(Bnum));
+}
+
+/*
+ * Initialize a Bnum in caller-provided memory (e.g. on the stack or inside
+ * another struct), with `num` as its value. Values that fit in the Bnum's inline
+ * blocks need no further memory at all; once it is no longer needed, any storage
+ * it did allocate must be freed with `Bnum_clear()`. Unlike with `Bnum_create()`,
+ * the Bnum never belongs to an arena.
+ *
+ * Parameters:  big_num     The Bnum to initialize.
+ *              num         The value to initialize it with.
+ */
+void Bnum_init(Bnum* big_num, uint64_t num) {
+    big_num->num_blocks = 0;
+    big_num->capacity = BNUM_INLINE_BLOCKS;
+    big_num->blocks = big_num->inline_blocks;
+    big_num->arena = NULL;
+    Bnum_set_u64(big_num, num);
+}
+
+/*
+ * Free the storage of a Bnum initialized with `Bnum_init()`. The Bnum is left
+ * holding zero, in its inline blocks, so it can still be used afterwards.
+ *
+ * Parameters:  big_num     The Bnum to clear.
+ */
+void Bnum_clear(Bnum* big_num) {
+    free_blocks(big_num, big_num->blocks, big_num->capacity);
+    big_num->num_blocks = 0;
+    if (!big_num->arena) {
+        big_num->capacity = BNUM_INLINE_BLOCKS;
+        big_num->blocks = big_num->inline_blocks;
+    }
+}
+
+/*
+ * Create a new Bnum with the same value as `src`. The allocated memory must be
+ * freed by the caller, using `Bnum_destroy()`.
+ *
+ * Parameters:  src     The Bnum to copy.
+ *
+ * Returns: A pointer to the newly created Bnum.
+ */
+Bnum* Bnum_copy(Bnum* src) {
+    Bnum* copy = Bnum_create(0);
+    Bnum_set(copy, src);
+
+    return copy;
+}
+
+/*
+ * Set the value of `dst` to that of `src`, reusing the storage of `dst` if it is
+ * large enough.
+ *
+ * Parameters:  dst     The Bnum to set.
+ *              src     The Bnum to copy the value of.
+ */
+void Bnum_set(Bnum* dst, Bnum* src) {
+    if (dst == src) { return; }
+
+    reserve_blocks(dst, src->num_blocks);
+    memcpy(dst->blocks, src->blocks, src->num_blocks * sizeof(Block));
+    dst->num_blocks = src->num_blocks;
+}
+
+/*
+ * Set the value of `dst` from an array of blocks, reusing the storage of `dst`.
+ * Leading zero blocks are allowed.
+ *
+ * Parameters:  dst     The Bnum to set.
+ *              blocks  The blocks of the new value, least significant first.
+ *              n       The number of blocks in `blocks`.
+ */
+void Bnum_set_blocks(Bnum* dst, const Block* blocks, int n) {
+    n = blocks_normalized_size(blocks, n);
+    reserve_blocks(dst, n);
+    memmove(dst->blocks, blocks, n * sizeof(Block));
+    dst->num_blocks = n;
+}
+
+/*
+ * Set the value of `dst` to `num`, reusing the storage of `dst`.
+ *
+ * Parameters:  dst     The Bnum to set.
+ *              num     The new value.
+ */
+void Bnum_set_u64(Bnum* dst, uint64_t num) {
+    dst->num_blocks = 0;
+    if (num == 0) { return; }
+
+    reserve_blocks(dst, 64 / BLOCK_SIZE);
+#if BLOCK_SIZE == 64
+    add_block(dst, num);
+#else
+    for (; num > 0; num >>= BLOCK_SIZE) {
+        add_block(dst, (Block) num & BLOCK_MASK);
+    }
+#endif
+}
+
+/*
+ * Exchange the values of `a` and `b`, without copying any blocks (unless only
+ * one of them belongs to an arena).
+ *
+ * Parameters:  a   The first Bnum.
+ *              b   The second Bnum.
+ */
+void Bnum_swap(Bnum* a, Bnum* b) {
+    if (a->arena != b->arena) {
+        // the storage of each must stay with its owner, so copy the values
+        Bnum* temp = Bnum_copy(a);
+        Bnum_set(a, b);
+        Bnum_set(b, temp);
+        Bnum_destroy(temp);
+        return;
     }
-    free(big_num);
+
+    Bnum temp = *a;
+    *a = *b;
+    *b = temp;
+
+    // inline blocks were swapped along with everything else
+    if (a->blocks == b->inline_blocks) { a->blocks = a->inline_blocks; }
+    if (b->blocks == a->inline_blocks) { b->blocks = b->inline_blocks; }
 }
 
 /*
@@ -64,15 +650,333 @@ void Bnum_destroy(Bnum* big_num) {
  * Parameters:  big_num     The Bnum to print.
  */
 void Bnum_print(Bnum* big_num) {
-    Block* cur = big_num->most_significant;
-    while (cur) {
-        printf("%032b", cur->val);
-        cur = cur->prev;
+    for (int i = big_num->num_blocks - 1; i >= 0; i--) {
+#if BLOCK_SIZE == 64
+        printf("%064llb", (unsigned long long) big_num->blocks[i]);
+#else
+        printf("%032b", big_num->blocks[i]);
+#endif
     }
     printf(" (blocks: %d)", big_num->num_blocks);
     printf("\n");
 }
 
+/*
+ * Get the size of the buffer needed to hold the digits of `x` in base `base` along
+ * with a terminating null character. This is exact for bases that are powers of
+ * two, and may be a few characters more than needed for other bases.
+ *
+ * Parameters:  x       The number to convert.
+ *              base    The base to convert to, from 2 to 36.
+ *
+ * Returns: The size of the buffer in bytes, or 0 if `base` isn't valid.
+ */
+size_t Bnum_str_size(Bnum* x, int base) {
+    if (base < 2 || base > 36) { return 0; }
+    if (x->num_blocks == 0) { return 2; }
+
+    int64_t bits = (int64_t) x->num_blocks * BLOCK_SIZE - block_clz(x->blocks[x->num_blocks - 1]);
+    if (!(base & (base - 1))) {
+        int base_bits = block_clz(1) - block_clz(base);
+        return (size_t) ((bits + base_bits - 1) / base_bits) + 1;
+    }
+
+    // with k digits fitting in a block, `base^(k + 1) > 2^BLOCK_SIZE`, so every
+    // `BLOCK_SIZE` bits make at most k + 1 digits
+    int chunk_digits = digits_per_block(base);
+
+    return (size_t) ((bits * (chunk_digits + 1) + BLOCK_SIZE - 1) / BLOCK_SIZE) + 1;
+}
+
+/*
+ * Write the digits of `x` in base `base` to `buf` as a null-terminated string,
+ * most significant digit first and with lowercase letters for digits above 9.
+ * `buf` must hold at least `Bnum_str_size(x, base)` bytes.
+ *
+ * For bases that aren't powers of two, large numbers are converted by dividing
+ * them by powers of the base recursively (see `blocks_to_str()`), which takes
+ * time close to that of a multiplication rather than quadratic time. The powers
+ * are cached per thread, for the last base used, until `Bnum_pool_trim()` is
+ * called or the thread exits.
+ *
+ * Parameters:  buf     Where to write the string.
+ *              base    The base to convert to, from 2 to 36.
+ *              x       The number to convert.
+ *
+ * Returns: `buf`, or NULL if `base` isn't valid.
+ */
+char* Bnum_to_str(char* buf, int base, Bnum* x) {
+    if (base < 2 || base > 36) { return NULL; }
+
+    // the buffer is large enough, so it is never flushed
+    StrSink sink = { .buf = buf, .size = SIZE_MAX, .len = 0, .file = NULL, .fd = -1 };
+    write_digits(&sink, x, base);
+    buf[sink.len] = '\0';
+
+    return buf;
+}
+
+/*
+ * Write the digits of `x` in base `base` to `file`, as `Bnum_to_str()` formats
+ * them but without a terminating null character or newline. The digits are
+ * produced into a buffer of STR_BUFFER_SIZE bytes, which is written out each time
+ * it fills up, so the number is never formatted in full and the stream sees only
+ * a few large writes.
+ *
+ * Parameters:  file    The stream to write to.
+ *              x       The number to write.
+ *              base    The base to write it in, from 2 to 36.
+ *
+ * Returns: 0 on success, -1 if `base` isn't valid or writing failed.
+ */
+int Bnum_fprint(FILE* file, Bnum* x, int base) {
+    if (base < 2 || base > 36) { return -1; }
+
+    StrSink sink = { .buf = mem_alloc(STR_BUFFER_SIZE), .size = STR_BUFFER_SIZE, .len = 0,
+            .file = file, .fd = -1 };
+    write_digits(&sink, x, base);
+    sink_flush(&sink);
+    mem_free(sink.buf, STR_BUFFER_SIZE);
+
+    return sink.error ? -1 : 0;
+}
+
+/*
+ * Write the digits of `x` in base `base` to the file descriptor `fd`, like
+ * `Bnum_fprint()` but with `write()` directly, bypassing stdio. Partial writes
+ * and writes interrupted by signals are retried.
+ *
+ * Parameters:  fd      The file descriptor to write to.
+ *              x       The number to write.
+ *              base    The base to write it in, from 2 to 36.
+ *
+ * Returns: 0 on success, -1 if `base` isn't valid or writing failed, in which case
+ *          `errno` tells why.
+ */
+int Bnum_write_fd(int fd, Bnum* x, int base) {
+    if (base < 2 || base > 36) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    StrSink sink = { .buf = mem_alloc(STR_BUFFER_SIZE), .size = STR_BUFFER_SIZE, .len = 0,
+            .file = NULL, .fd = fd };
+    write_digits(&sink, x, base);
+    sink_flush(&sink);
+    mem_free(sink.buf, STR_BUFFER_SIZE);
+
+    return sink.error ? -1 : 0;
+}
+
+/*
+ * Create a Bnum from a string of digits in base `base`, most significant first.
+ * Letters stand for digits above 9 in either case; there is no sign, prefix or
+ * whitespace. The allocated memory must be freed by the caller, using
+ * `Bnum_destroy()`.
+ *
+ * For bases that aren't powers of two, long strings are converted by splitting
+ * them at powers of the base recursively (see `blocks_from_str()`), which takes
+ * time close to that of a multiplication rather than quadratic time.
+ *
+ * Parameters:  str     The digits; need not be null-terminated.
+ *              len     The number of digits in `str`.
+ *              base    The base of the digits, from 2 to 36.
+ *
+ * Returns: A pointer to the newly created Bnum, or NULL if `base` isn't valid,
+ *          `len` is 0 or `str` contains a character that isn't a digit.
+ */
+Bnum* Bnum_from_str(const char* str, size_t len, int base) {
+    if (base < 2 || base > 36 || len == 0) { return NULL; }
+
+    // power-of-two bases are validated as they are packed
+    int pow2 = !(base & (base - 1));
+    for (size_t i = 0; i < len && !pow2; i++) {
+        if (digit_value(str[i]) >= base) { return NULL; }
+    }
+
+    while (len > 1 && str[0] == '0') {
+        str++;
+        len--;
+    }
+
+    // each full chunk of digits fits in a block
+    int chunk_digits = digits_per_block(base);
+    int capacity = (int) ((len + chunk_digits - 1) / chunk_digits);
+
+    Bnum* big_num = Bnum_create(0);
+    reserve_blocks(big_num, capacity);
+    if (pow2) {
+        int n = from_str_pow2(big_num->blocks, str, len, block_clz(1) - block_clz(base));
+        if (n < 0) {
+            Bnum_destroy(big_num);
+            return NULL;
+        }
+        big_num->num_blocks = n;
+    }
+    else {
+        const PowerTower* tower = power_tower(base, capacity);
+        big_num->num_blocks = blocks_from_str(big_num->blocks, str, len, tower);
+    }
+
+    return big_num;
+}
+
+/*
+ * Write the digits of `x` in hexadecimal to `buf` as a null-terminated string,
+ * with lowercase letters. Same as `Bnum_to_str(buf, 16, x)`.
+ *
+ * Parameters:  buf     Where to write the string; must hold at least
+ *                      `Bnum_str_size(x, 16)` bytes.
+ *              x       The number to convert.
+ *
+ * Returns: `buf`.
+ */
+char* Bnum_to_hex(char* buf, Bnum* x) {
+    return Bnum_to_str(buf, 16, x);
+}
+
+/*
+ * Create a Bnum from a string of hexadecimal digits, in either case and without a
+ * prefix. Same as `Bnum_from_str(str, len, 16)`.
+ *
+ * Parameters:  str     The digits; need not be null-terminated.
+ *              len     The number of digits in `str`.
+ *
+ * Returns: A pointer to the newly created Bnum, or NULL if `len` is 0 or `str`
+ *          contains a character that isn't a hexadecimal digit.
+ */
+Bnum* Bnum_from_hex(const char* str, size_t len) {
+    return Bnum_from_str(str, len, 16);
+}
+
+/*
+ * Write `x` to `file` in binary, in a versioned format that records the block
+ * width and byte order (see FILE_HEADER_SIZE), so that `Bnum_read()` can read it
+ * back on any machine and `Bnum_map()` can map it on one like this one.
+ *
+ * Parameters:  file    The stream to write to, opened in binary mode.
+ *              x       The number to write.
+ *
+ * Returns: 0 on success, -1 if writing failed.
+ */
+int Bnum_write(FILE* file, Bnum* x) {
+    unsigned char header[FILE_HEADER_SIZE] = FILE_MAGIC;
+    header[4] = FILE_VERSION;
+    header[5] = BLOCK_SIZE;
+    header[6] = HOST_BIG_ENDIAN;
+    uint64_t num_blocks = x->num_blocks;
+    memcpy(header + 8, &num_blocks, sizeof(num_blocks));
+
+    if (fwrite(header, 1, FILE_HEADER_SIZE, file) != FILE_HEADER_SIZE) { return -1; }
+    size_t n = x->num_blocks;
+    if (n > 0 && fwrite(x->blocks, sizeof(Block), n, file) != n) { return -1; }
+
+    return 0;
+}
+
+/*
+ * Read a number written by `Bnum_write()` from `file`, converting it if it was
+ * written with a different block width or byte order. The allocated memory must
+ * be freed by the caller, using `Bnum_destroy()`.
+ *
+ * Parameters:  file    The stream to read from, opened in binary mode.
+ *
+ * Returns: A pointer to the newly created Bnum, or NULL if reading failed or the
+ *          data isn't in the format of `Bnum_write()`.
+ */
+Bnum* Bnum_read(FILE* file) {
+    unsigned char header[FILE_HEADER_SIZE];
+    int block_bits, big_endian;
+    uint64_t num_blocks;
+    if (fread(header, 1, FILE_HEADER_SIZE, file) != FILE_HEADER_SIZE
+            || decode_header(header, &block_bits, &big_endian, &num_blocks) < 0) {
+        return NULL;
+    }
+
+    // the blocks are read as bytes, then put in the order of this machine's blocks
+    size_t bytes = num_blocks * (block_bits / 8);
+    int n = (int) ((bytes + sizeof(Block) - 1) / sizeof(Block));
+    Bnum* big_num = Bnum_create(0);
+    reserve_blocks(big_num, n);
+    if (n > 0) { big_num->blocks[n - 1] = 0; }
+    if (fread(big_num->blocks, 1, bytes, file) != bytes) {
+        Bnum_destroy(big_num);
+        return NULL;
+    }
+
+    unsigned char* data = (unsigned char*) big_num->blocks;
+    if (big_endian) { swap_bytes(data, bytes, block_bits / 8); }
+    if (HOST_BIG_ENDIAN) { swap_bytes(data, n * sizeof(Block), sizeof(Block)); }
+    big_num->num_blocks = blocks_normalized_size(big_num->blocks, n);
+
+    return big_num;
+}
+
+/*
+ * Map a file written by `Bnum_write()` into memory and return a Bnum that uses
+ * the file's blocks directly, without reading or copying them. Pages are loaded
+ * on demand and are shared through the page cache with every other process that
+ * maps or reads the file. The file must have been written with this machine's
+ * block width and byte order; use `Bnum_read()` otherwise.
+ *
+ * The Bnum is read-only: it may be used as an operand but never as a destination
+ * (or with `Bnum_swap()`), and it must be released with `Bnum_unmap()` rather
+ * than `Bnum_destroy()`. The file must not be modified while it is mapped.
+ *
+ * Parameters:  path    The path of the file.
+ *
+ * Returns: A pointer to the mapped Bnum, or NULL if the file can't be opened or
+ *          mapped or isn't a matching file from `Bnum_write()`.
+ */
+Bnum* Bnum_map(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { return NULL; }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < FILE_HEADER_SIZE) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = st.st_size;
+    unsigned char* addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) { return NULL; }
+
+    int block_bits, big_endian;
+    uint64_t num_blocks;
+    Block* blocks = (Block*) (addr + FILE_HEADER_SIZE);
+    if (decode_header(addr, &block_bits, &big_endian, &num_blocks) < 0
+            || block_bits != BLOCK_SIZE || big_endian != HOST_BIG_ENDIAN
+            || num_blocks > (size - FILE_HEADER_SIZE) / sizeof(Block)
+            || (num_blocks > 0 && blocks[num_blocks - 1] == 0)) {
+        munmap(addr, size);
+        return NULL;
+    }
+
+    MappedBnum* mapped = mem_alloc(sizeof(MappedBnum));
+    mapped->addr = addr;
+    mapped->size = size;
+    Bnum_init(&mapped->num, 0);
+    if (num_blocks > 0) {
+        mapped->num.blocks = blocks;
+        mapped->num.num_blocks = (int) num_blocks;
+        mapped->num.capacity = (int) num_blocks;
+    }
+
+    return &mapped->num;
+}
+
+/*
+ * Release a Bnum from `Bnum_map()`, unmapping its file.
+ *
+ * Parameters:  big_num     The Bnum to release.
+ */
+void Bnum_unmap(Bnum* big_num) {
+    MappedBnum* mapped = (MappedBnum*) big_num;
+    munmap(mapped->addr, mapped->size);
+    mem_free(mapped, sizeof(MappedBnum));
+}
+
 /*
  * Determine if `a` and `b` are equal. Analogous to `a == b`.
  *
@@ -83,18 +987,10 @@ void Bnum_print(Bnum* big_num) {
  *          0 otherwise.
  */
 int Bnum_eq(Bnum* a, Bnum* b) {
-    Block* cur_block_a = a->least_significant;
-    Block* cur_block_b = b->least_significant;
+    if (a->num_blocks != b->num_blocks) { return 0; }
+    if (a->num_blocks == 1) { return a->blocks[0] == b->blocks[0]; }
 
-    while (cur_block_a && cur_block_b) {
-        if (cur_block_a->val != cur_block_b->val) { return 0; }
-        cur_block_a = cur_block_a->next;
-        cur_block_b = cur_block_b->next;
-    }
-
-    if (cur_block_a || cur_block_b) { return 0; }
-
-    return 1;
+    return memcmp(a->blocks, b->blocks, a->num_blocks * sizeof(Block)) == 0;
 }
 
 /*
@@ -120,20 +1016,7 @@ int Bnum_ne(Bnum* a, Bnum* b) {
  *          0 otherwise.
  */
 int Bnum_le(Bnum* a, Bnum* b) {
-    if (a->num_blocks != b->num_blocks) { return a->num_blocks < b->num_blocks; }
-
-    Block* cur_block_a = a->most_significant;
-    Block* cur_block_b = b->most_significant;
-    
-    while (cur_block_a && cur_block_b) {
-        if (cur_block_a->val != cur_block_b->val) {
-            return cur_block_a->val < cur_block_b->val;
-        }
-        cur_block_a = cur_block_a->prev;
-        cur_block_b = cur_block_b->prev;
-    }
-
-    return 1;
+    return compare(a, b) <= 0;
 }
 
 /*
@@ -159,20 +1042,7 @@ int Bnum_lt(Bnum* a, Bnum* b) {
  *          0 otherwise.
  */
 int Bnum_ge(Bnum* a, Bnum* b) {
-    if (a->num_blocks != b->num_blocks) { return a->num_blocks > b->num_blocks; }
-
-    Block* cur_block_a = a->most_significant;
-    Block* cur_block_b = b->most_significant;
-    
-    while (cur_block_a && cur_block_b) {
-        if (cur_block_a->val != cur_block_b->val) {
-            return cur_block_a->val > cur_block_b->val;
-        }
-        cur_block_a = cur_block_a->prev;
-        cur_block_b = cur_block_b->prev;
-    }
-
-    return 1;
+    return compare(a, b) >= 0;
 }
 
 /*
@@ -199,131 +1069,4181 @@ int Bnum_gt(Bnum* a, Bnum* b) {
  */
 Bnum* Bnum_sum(Bnum* a, Bnum* b) {
     Bnum* sum = Bnum_create(0);
+    Bnum_add_to(sum, a, b);
 
-    Block* cur_block_a = a->least_significant;
-    Block* cur_block_b = b->least_significant;
-    uint64_t block_sum;
-    uint64_t carry = 0;
+    return sum;
+}
 
-    while (cur_block_a && cur_block_b) {
-        block_sum = ((uint64_t) cur_block_a->val) +
-            ((uint64_t) cur_block_b->val) + carry;
-        carry = block_sum >> BLOCK_SIZE;
-        add_block(sum, (uint32_t) block_sum & BLOCK_MASK);
+/*
+ * Compute the sum of `a` and `b` and store it in `dst`, reusing its storage if
+ * it is large enough. `dst` may be the same Bnum as `a` and/or `b`.
+ *
+ * Parameters:  dst     Where to store the result.
+ *              a       Left hand side of the expression.
+ *              b       Right hand side of the expression.
+ */
+void Bnum_add_to(Bnum* dst, Bnum* a, Bnum* b) {
+    if (a->num_blocks < b->num_blocks) { Bnum* temp = a; a = b; b = temp; }
 
-        cur_block_a = cur_block_a->next;
-        cur_block_b = cur_block_b->next;
+    if (a->num_blocks <= 1) {
+        // single blocks; every Bnum has room for the two-block result
+        Block x = a->num_blocks ? a->blocks[0] : 0;
+        Block y = b->num_blocks ? b->blocks[0] : 0;
+        Block sum = x + y;
+        dst->blocks[0] = sum;
+        dst->blocks[1] = sum < x;
+        dst->num_blocks = sum < x ? 2 : sum != 0;
+        return;
     }
 
-    Block* cur_block = cur_block_a ? cur_block_a : cur_block_b;
-    while (cur_block) {
-        block_sum = ((uint64_t) cur_block->val) + carry;
-        carry = block_sum >> BLOCK_SIZE;
-        add_block(sum, (uint32_t) block_sum & BLOCK_MASK);
-
-        cur_block = cur_block->next;
-    }
+    // blocks_add() handles its result being one of its inputs, so `dst` just
+    // needs to be large enough (which may move its blocks, so grow it first)
+    int an = a->num_blocks;
+    reserve_blocks(dst, an + 1);
+    dst->blocks[an] = blocks_add(dst->blocks, a->blocks, an, b->blocks, b->num_blocks);
+    dst->num_blocks = an + 1;
+    normalize(dst);
+}
 
-    return sum;
+/*
+ * Add `x` to `acc`. Analogous to `acc += x`.
+ *
+ * Parameters:  acc     The Bnum to add to.
+ *              x       The value to add.
+ */
+void Bnum_add_inplace(Bnum* acc, Bnum* x) {
+    Bnum_add_to(acc, acc, x);
 }
 
 /*
- * Compute the product of `a` and `b` and return it inside of a new Bnum. This Bnum
- * should be destroyed by the caller.
+ * Compute the difference of `a` and `b` and return it inside of a new Bnum. This
+ * Bnum should be destroyed by the caller. Bnums are unsigned, so the difference
+ * is only defined when `a >= b`.
  *
  * Parameters:  a   Left hand side of the expression.
  *              b   Right hand side of the expression.
  *
- * Returns: A pointer to a new Bnum with value equal to the product of `a` and `b`.
+ * Returns: A pointer to a new Bnum with value equal to `a - b`, or NULL if `a < b`.
  */
-Bnum* Bnum_mult(Bnum* a, Bnum* b) {
-    Bnum* product = Bnum_create(0);
-    Bnum* cur_product;
-
-    Block* cur_block_a = a->least_significant;
-    Block* cur_block_b;
-    uint64_t block_product;
-    uint64_t carry = 0;
-    int shift = 0;
-
-    while (cur_block_a) {
-        cur_product = Bnum_create(0);
-        for (int i = 0; i < shift; i++) { add_block(cur_product, (uint32_t) 0); }
-
-        // multiply by each block of [b]
-        cur_block_b = b->least_significant;
-        carry = 0;
-        while (cur_block_b) {
-            block_product = ((uint64_t) cur_block_a->val) *
-                ((uint64_t) cur_block_b->val) + carry;
-            carry = block_product >> BLOCK_SIZE;
-            add_block(cur_product, (uint32_t) block_product & BLOCK_MASK);
-
-            cur_block_b = cur_block_b->next;
-        }
-        if (carry) { add_block(cur_product, (uint32_t) carry); }
-
-        // add result to [product]
-        Bnum* temp = product;
-        product = Bnum_sum(temp, cur_product);
-        Bnum_destroy(temp);
+Bnum* Bnum_sub(Bnum* a, Bnum* b) {
+    if (compare(a, b) < 0) { return NULL; }
 
-        Bnum_destroy(cur_product);
-        cur_block_a = cur_block_a->next;
-        shift++;
-    }
+    Bnum* difference = Bnum_create(0);
+    Bnum_sub_to(difference, a, b);
 
-    return product;
+    return difference;
 }
 
 /*
- * Compute the value of `a` to the power of `n` and return it inside of a new Bnum.
- * Caller should use `Bnum_destroy()` to free this Bnum.
+ * Compute the difference of `a` and `b` and store it in `dst`, reusing its
+ * storage if it is large enough. `dst` may be the same Bnum as `a` and/or `b`.
  *
- * Parameters:  a   Left hand side of the expression.
- *              b   Right hand side of the expression.
+ * Parameters:  dst     Where to store the result.
+ *              a       Left hand side of the expression.
+ *              b       Right hand side of the expression.
  *
- * Returns: A pointer to a new Bnum with value equal to `a` to the power of `n`.
+ * Returns: 0 on success, or -1 if `a < b`, in which case `dst` is left unchanged.
  */
-Bnum* Bnum_pow(Bnum* a, int n) {
-    Bnum* result = Bnum_create(1);
-    
-    for (int i = 0; i < n; i++) {
-        Bnum* temp = result;
-        result = Bnum_mult(temp, a);
-        Bnum_destroy(temp);
-    }
-
-    return result;
-}
+int Bnum_sub_to(Bnum* dst, Bnum* a, Bnum* b) {
+    if (compare(a, b) < 0) { return -1; }
 
+    // as in Bnum_add_to(), grow `dst` before taking pointers to the inputs
+    int an = a->num_blocks;
+    reserve_blocks(dst, an);
+    blocks_sub(dst->blocks, a->blocks, an, b->blocks, b->num_blocks);
+    dst->num_blocks = an;
+    normalize(dst);
 
-/* ---------- Helper Functions ---------- */
+    return 0;
+}
 
 /*
- * Add a new Block to a Bnum such that the newly added block is the most numerically
- * significant.
+ * Subtract `x` from `acc`. Analogous to `acc -= x`.
  *
- * Parameters:  big_num     The Bnum to add to.
- *              val         Value to be stored in the new Block.
+ * Parameters:  acc     The Bnum to subtract from.
+ *              x       The value to subtract.
+ *
+ * Returns: 0 on success, or -1 if `acc < x`, in which case `acc` is left unchanged.
  */
-void add_block(Bnum* big_num, uint32_t val) {
-    // create block
-    Block* cur_block = malloc(sizeof(Block));
-    cur_block->val = val;
-    cur_block->next = NULL;
-    cur_block->prev = NULL;
-
-    // add block to list
-    if (big_num->least_significant == NULL) {
-        big_num->least_significant = cur_block;
-        big_num->most_significant = cur_block;
-    }
-    else {
-        big_num->most_significant->next = cur_block;
-        cur_block->prev = big_num->most_significant;
-        big_num->most_significant = cur_block;
-    }
+int Bnum_sub_inplace(Bnum* acc, Bnum* x) {
+    return Bnum_sub_to(acc, acc, x);
+}
 
-    big_num->num_blocks++;
+/*
+ * Compute the product of `a` and `b` and return it inside of a new Bnum. This Bnum
+ * should be destroyed by the caller.
+ *
+ * Small operands are multiplied with the schoolbook method; as the operands grow
+ * past the `BNUM_*_THRESHOLD` sizes, Karatsuba, then Toom-Cook and finally
+ * number theoretic transform based multiplication are used instead.
+ *
+ * Parameters:  a   Left hand side of the expression.
+ *              b   Right hand side of the expression.
+ *
+ * Returns: A pointer to a new Bnum with value equal to the product of `a` and `b`.
+ */
+Bnum* Bnum_mult(Bnum* a, Bnum* b) {
+    Bnum* product = Bnum_create(0);
+    Bnum_mul_to(product, a, b);
+
+    return product;
+}
+
+/*
+ * Compute the product of `a` and `b` and store it in `dst`, reusing its storage
+ * if it is large enough and is not also an input. `dst` may be the same Bnum as
+ * `a` and/or `b`.
+ *
+ * Parameters:  dst     Where to store the result.
+ *              a       Left hand side of the expression.
+ *              b       Right hand side of the expression.
+ */
+void Bnum_mul_to(Bnum* dst, Bnum* a, Bnum* b) {
+    if (a->num_blocks == 0 || b->num_blocks == 0) {
+        dst->num_blocks = 0;
+        return;
+    }
+    if (a->num_blocks < b->num_blocks) { Bnum* temp = a; a = b; b = temp; }
+
+    if (a->num_blocks == 1) {
+        // single blocks; every Bnum has room for the two-block result
+        DBlock product = (DBlock) a->blocks[0] * b->blocks[0];
+        dst->blocks[0] = (Block) product;
+        dst->blocks[1] = (Block) (product >> BLOCK_SIZE);
+        dst->num_blocks = dst->blocks[1] ? 2 : 1;
+        return;
+    }
+
+    int n = a->num_blocks + b->num_blocks;
+    int capacity = n;
+    Block* blocks = result_blocks(dst, &capacity, a, b);
+    blocks_mul(blocks, a->blocks, a->num_blocks, b->blocks, b->num_blocks);
+    set_result_blocks(dst, blocks, capacity, n);
+}
+
+/*
+ * Multiply `acc` by `x`. Analogous to `acc *= x`.
+ *
+ * Parameters:  acc     The Bnum to multiply.
+ *              x       The value to multiply by.
+ */
+void Bnum_mul_inplace(Bnum* acc, Bnum* x) {
+    Bnum_mul_to(acc, acc, x);
+}
+
+/*
+ * Compute the square of `a` and return it inside of a new Bnum. This Bnum should
+ * be destroyed by the caller. Equivalent to `Bnum_mult(a, a)`, which also ends up
+ * here, but each level of the multiplication algorithms takes advantage of both
+ * operands being the same, e.g. by computing each cross product only once.
+ *
+ * Parameters:  a   The Bnum to square.
+ *
+ * Returns: A pointer to a new Bnum with value equal to `a` squared.
+ */
+Bnum* Bnum_sqr(Bnum* a) {
+    Bnum* square = Bnum_create(0);
+    Bnum_sqr_to(square, a);
+
+    return square;
+}
+
+/*
+ * Compute the square of `a` and store it in `dst`. `dst` may be the same Bnum as
+ * `a`.
+ *
+ * Parameters:  dst     Where to store the result.
+ *              a       The Bnum to square.
+ */
+void Bnum_sqr_to(Bnum* dst, Bnum* a) {
+    Bnum_mul_to(dst, a, a);
+}
+
+/*
+ * Compute the value of `a` to the power of `n` and return it inside of a new Bnum.
+ * Caller should use `Bnum_destroy()` to free this Bnum.
+ *
+ * Parameters:  a   Left hand side of the expression.
+ *              n   Right hand side of the expression. Values `n <= 0` give 1.
+ *
+ * Returns: A pointer to a new Bnum with value equal to `a` to the power of `n`, or
+ *          NULL if the result would be too large for a Bnum.
+ */
+Bnum* Bnum_pow(Bnum* a, int n) {
+    Bnum* result = Bnum_create(0);
+    if (Bnum_pow_to(result, a, n) < 0) {
+        Bnum_destroy(result);
+        return NULL;
+    }
+
+    return result;
+}
+
+/*
+ * Compute the value of `a` to the power of `n` and store it in `dst`. `dst` may
+ * be the same Bnum as `a`.
+ *
+ * Uses left-to-right sliding window exponentiation: the bits of `n` are scanned
+ * from the top, squaring once per bit and multiplying by a precomputed odd power
+ * of `a` once per window of up to `POW_WINDOW_MAX` bits. The intermediate results
+ * alternate between two buffers sized for the final result, one of which is
+ * `dst`'s own storage when it is large enough.
+ *
+ * Parameters:  dst     Where to store the result.
+ *              a       Left hand side of the expression.
+ *              n       Right hand side of the expression. Values `n <= 0` give 1.
+ *
+ * Returns: 0, or -1 if the result would be too large for a Bnum, in which case
+ *          `dst` is left unchanged.
+ */
+int Bnum_pow_to(Bnum* dst, Bnum* a, int n) {
+    if (n <= 0 || (a->num_blocks == 1 && a->blocks[0] == 1)) {
+        Bnum_set_u64(dst, 1);
+        return 0;
+    }
+    if (a->num_blocks == 0) {
+        dst->num_blocks = 0;
+        return 0;
+    }
+
+    int64_t bits = (int64_t) a->num_blocks * BLOCK_SIZE;
+    for (Block top = a->blocks[a->num_blocks - 1]; !(top >> (BLOCK_SIZE - 1)); top <<= 1) {
+        bits--;
+    }
+    // a^n has at most `bits * n` bits; products are written out in full before
+    // being normalized, which can take one more block than that
+    if (bits > ((int64_t) INT_MAX - 1) * BLOCK_SIZE / n) { return -1; }
+    int max_blocks = (int) ((bits * n + BLOCK_SIZE - 1) / BLOCK_SIZE) + 1;
+
+    int exp_bits = 0;
+    while (exp_bits < 31 && (n >> exp_bits) > 0) { exp_bits++; }
+    int window = exp_bits > 24 ? 4 : exp_bits > 8 ? 3 : exp_bits > 3 ? 2 : 1;
+
+    // odd powers a, a^3, ..., a^(2^window - 1)
+    Bnum* powers[1 << (POW_WINDOW_MAX - 1)];
+    powers[0] = a;
+    if (window > 1) {
+        Bnum* square = Bnum_sqr(a);
+        for (int i = 1; i < 1 << (window - 1); i++) {
+            powers[i] = Bnum_mult(powers[i - 1], square);
+        }
+        Bnum_destroy(square);
+    }
+
+    // either buffer may end up holding the result, so both come from `dst`'s
+    // allocator
+    int cur_capacity = max_blocks;
+    int next_capacity = max_blocks;
+    Block* cur = result_blocks(dst, &cur_capacity, a, a);
+    Block* next = alloc_blocks(dst, &next_capacity);
+    int cur_len = 0;
+
+    for (int i = exp_bits - 1; i >= 0;) {
+        if (!((n >> i) & 1)) {
+            blocks_sqr(next, cur, cur_len);
+            cur_len = blocks_normalized_size(next, 2 * cur_len);
+            swap_buffers(&cur, &cur_capacity, &next, &next_capacity);
+            i--;
+            continue;
+        }
+
+        // the longest window of at most `window` bits starting at bit `i` and
+        // ending in a 1 bit
+        int low = i - window + 1 < 0 ? 0 : i - window + 1;
+        while (!((n >> low) & 1)) { low++; }
+        int value = (n >> low) & ((1 << (i - low + 1)) - 1);
+        Bnum* power = powers[value >> 1];
+
+        if (cur_len == 0) {
+            memcpy(cur, power->blocks, power->num_blocks * sizeof(Block));
+            cur_len = power->num_blocks;
+        }
+        else {
+            for (int j = i; j >= low; j--) {
+                blocks_sqr(next, cur, cur_len);
+                cur_len = blocks_normalized_size(next, 2 * cur_len);
+                swap_buffers(&cur, &cur_capacity, &next, &next_capacity);
+            }
+            if (cur_len >= power->num_blocks) {
+                blocks_mul(next, cur, cur_len, power->blocks, power->num_blocks);
+            }
+            else {
+                blocks_mul(next, power->blocks, power->num_blocks, cur, cur_len);
+            }
+            cur_len = blocks_normalized_size(next, cur_len + power->num_blocks);
+            swap_buffers(&cur, &cur_capacity, &next, &next_capacity);
+        }
+        i = low - 1;
+    }
+
+    for (int i = 1; i < 1 << (window - 1); i++) { Bnum_destroy(powers[i]); }
+
+    // the result may have ended up in either buffer
+    if (next == dst->blocks) {
+        memcpy(next, cur, cur_len * sizeof(Block));
+        free_blocks(dst, cur, cur_capacity);
+        dst->num_blocks = cur_len;
+    }
+    else {
+        free_blocks(dst, next, next_capacity);
+        set_result_blocks(dst, cur, cur_capacity, cur_len);
+    }
+
+    return 0;
+}
+
+/*
+ * Divide `a` by `b`, storing the quotient `a / b` (rounded down) in `q` and the
+ * remainder `a % b` in `r`. Either of `q` and `r` may be NULL if that part of the
+ * result isn't needed, and each may be the same Bnum as `a` and/or `b`, but not
+ * as each other.
+ *
+ * Divisors of a single block are handled in one pass with a precomputed
+ * reciprocal. Longer divisors use schoolbook long division, and past the
+ * `BNUM_*_DIV_THRESHOLD` sizes divide-and-conquer division or multiplication by a
+ * Newton-iterated reciprocal, which cost a small multiple of a multiplication.
+ *
+ * Parameters:  q   Where to store the quotient, or NULL.
+ *              r   Where to store the remainder, or NULL.
+ *              a   The dividend.
+ *              b   The divisor.
+ *
+ * Returns: 0 on success, or -1 if `b` is zero, in which case `q` and `r` are left
+ *          unchanged.
+ */
+int Bnum_divmod(Bnum* q, Bnum* r, Bnum* a, Bnum* b) {
+    if (b->num_blocks == 0) { return -1; }
+
+    divmod(q, r, a, b, NULL);
+
+    return 0;
+}
+
+/*
+ * Compute the quotient of `a` and `b`, rounded down, and return it inside of a
+ * new Bnum. This Bnum should be destroyed by the caller.
+ *
+ * Parameters:  a   The dividend.
+ *              b   The divisor.
+ *
+ * Returns: A pointer to a new Bnum with value equal to `a / b`, or NULL if `b` is
+ *          zero.
+ */
+Bnum* Bnum_div(Bnum* a, Bnum* b) {
+    if (b->num_blocks == 0) { return NULL; }
+
+    Bnum* quotient = Bnum_create(0);
+    Bnum_divmod(quotient, NULL, a, b);
+
+    return quotient;
+}
+
+/*
+ * Compute the remainder of dividing `a` by `b` and return it inside of a new
+ * Bnum. This Bnum should be destroyed by the caller.
+ *
+ * Parameters:  a   The dividend.
+ *              b   The divisor.
+ *
+ * Returns: A pointer to a new Bnum with value equal to `a % b`, or NULL if `b` is
+ *          zero.
+ */
+Bnum* Bnum_mod(Bnum* a, Bnum* b) {
+    if (b->num_blocks == 0) { return NULL; }
+
+    Bnum* remainder = Bnum_create(0);
+    Bnum_divmod(NULL, remainder, a, b);
+
+    return remainder;
+}
+
+/*
+ * Precompute what is needed to divide by `b` quickly, for when many values are
+ * divided by the same divisor. The divisor is normalized once, and for long
+ * divisors its reciprocal is computed too, so that each division by it (with
+ * `Bnum_divmod_by()` or `Bnum_mod_by()`) takes just two multiplications. The
+ * divisor object does not refer to `b` afterwards and must be destroyed by the
+ * caller, using `Bnum_divisor_destroy()`.
+ *
+ * Parameters:  b   The divisor.
+ *
+ * Returns: A pointer to the new divisor object, or NULL if `b` is zero.
+ */
+Bnum_divisor* Bnum_divisor_create(Bnum* b) {
+    int n = b->num_blocks;
+    if (n == 0) { return NULL; }
+
+    int use_reciprocal = n >= get_threshold(BNUM_DIVISOR_NEWTON_THRESHOLD);
+    size_t size = sizeof(Bnum_divisor) + (n + (use_reciprocal ? n + 1 : 0)) * sizeof(Block);
+    Bnum_divisor* divisor = mem_alloc(size);
+    divisor->num_blocks = n;
+    divisor->shift = block_clz(b->blocks[n - 1]);
+    divisor->d = (Block*) (divisor + 1);
+    divisor->x = use_reciprocal ? divisor->d + n : NULL;
+
+    blocks_lshift(divisor->d, b->blocks, n, divisor->shift);
+    if (n == 1) { divisor->inverse = invert_limb(divisor->d[0]); }
+    else { divisor->inverse = invert_3by2(divisor->d[n - 1], divisor->d[n - 2]); }
+    if (use_reciprocal) { blocks_invert(divisor->x, divisor->d, n); }
+
+    return divisor;
+}
+
+/*
+ * Destroy a divisor object and free all of its associated memory.
+ *
+ * Parameters:  divisor     The divisor to destroy.
+ */
+void Bnum_divisor_destroy(Bnum_divisor* divisor) {
+    int n = divisor->num_blocks;
+    mem_free(divisor, sizeof(Bnum_divisor) + (n + (divisor->x ? n + 1 : 0)) * sizeof(Block));
+}
+
+/*
+ * Divide `a` by a precomputed divisor, like `Bnum_divmod()`. Either of `q` and `r`
+ * may be NULL if that part of the result isn't needed, and each may be the same
+ * Bnum as `a`, but not as each other.
+ *
+ * Parameters:  q           Where to store the quotient, or NULL.
+ *              r           Where to store the remainder, or NULL.
+ *              a           The dividend.
+ *              divisor     The divisor, from `Bnum_divisor_create()`.
+ */
+void Bnum_divmod_by(Bnum* q, Bnum* r, Bnum* a, Bnum_divisor* divisor) {
+    divmod(q, r, a, NULL, divisor);
+}
+
+/*
+ * Compute the remainder of dividing `a` by a precomputed divisor and return it
+ * inside of a new Bnum. This Bnum should be destroyed by the caller.
+ *
+ * Parameters:  a           The dividend.
+ *              divisor     The divisor, from `Bnum_divisor_create()`.
+ *
+ * Returns: A pointer to a new Bnum with value equal to `a % divisor`.
+ */
+Bnum* Bnum_mod_by(Bnum* a, Bnum_divisor* divisor) {
+    Bnum* remainder = Bnum_create(0);
+    divmod(NULL, remainder, a, NULL, divisor);
+
+    return remainder;
+}
+
+/*
+ * Create a context for Montgomery multiplication modulo `m`, which must be odd.
+ * Numbers are multiplied in Montgomery form, `a * R mod m` where `R = B^n` for the
+ * block base B and the `n` blocks of `m`, and the reduction after each product
+ * then needs only multiplications instead of a division. The context does not
+ * refer to `m` afterwards and must be destroyed by the caller, using
+ * `Bnum_mont_ctx_destroy()`.
+ *
+ * Parameters:  m   The modulus.
+ *
+ * Returns: A pointer to the new context, or NULL if `m` is even or zero.
+ */
+Bnum_mont_ctx* Bnum_mont_ctx_create(Bnum* m) {
+    int n = m->num_blocks;
+    if (n == 0 || !(m->blocks[0] & 1)) { return NULL; }
+
+    Bnum_mont_ctx* ctx = mem_alloc(sizeof(Bnum_mont_ctx) + 2 * n * sizeof(Block));
+    ctx->num_blocks = n;
+    ctx->minv = mont_inverse(m->blocks[0]);
+    ctx->m = (Block*) (ctx + 1);
+    ctx->r2 = ctx->m + n;
+    memcpy(ctx->m, m->blocks, n * sizeof(Block));
+
+    // B^2n has 2n + 1 blocks, so the quotient has n + 2
+    int temp_size = (2 * n + 1) + (n + 2);
+    Block* temp = temp_blocks(temp_size);
+    memset(temp, 0, 2 * n * sizeof(Block));
+    temp[2 * n] = 1;
+    blocks_divrem(temp + 2 * n + 1, ctx->r2, temp, 2 * n + 1, ctx->m, n);
+    free_temp_blocks(temp, temp_size);
+
+    return ctx;
+}
+
+/*
+ * Destroy a Montgomery context and free all of its associated memory.
+ *
+ * Parameters:  ctx     The context to destroy.
+ */
+void Bnum_mont_ctx_destroy(Bnum_mont_ctx* ctx) {
+    mem_free(ctx, sizeof(Bnum_mont_ctx) + 2 * ctx->num_blocks * sizeof(Block));
+}
+
+/*
+ * Convert `a` into Montgomery form, storing `a * R mod m` in `dst`. `dst` may be the
+ * same Bnum as `a`.
+ *
+ * Parameters:  dst     Where to store the result.
+ *              a       The number to convert.
+ *              ctx     The Montgomery context of the modulus.
+ */
+void Bnum_to_mont(Bnum* dst, Bnum* a, Bnum_mont_ctx* ctx) {
+    int n = ctx->num_blocks;
+    int temp_size = 3 * n;
+    Block* temp = temp_blocks(temp_size);
+    load_residue(temp, a, ctx->m, n);
+
+    int capacity = n;
+    Block* blocks = result_blocks(dst, &capacity, a, a);
+    blocks_mont_mul(blocks, temp, ctx->r2, ctx, temp + n);
+    set_result_blocks(dst, blocks, capacity, n);
+    free_temp_blocks(temp, temp_size);
+}
+
+/*
+ * Convert `a` out of Montgomery form, storing `a / R mod m` in `dst`. `dst` may be
+ * the same Bnum as `a`.
+ *
+ * Parameters:  dst     Where to store the result.
+ *              a       The number to convert.
+ *              ctx     The Montgomery context of the modulus.
+ */
+void Bnum_from_mont(Bnum* dst, Bnum* a, Bnum_mont_ctx* ctx) {
+    int n = ctx->num_blocks;
+    Block* temp = temp_blocks(2 * n);
+    load_residue(temp, a, ctx->m, n);
+    memset(temp + n, 0, n * sizeof(Block));
+
+    int capacity = n;
+    Block* blocks = result_blocks(dst, &capacity, a, a);
+    blocks_redc(blocks, temp, ctx);
+    set_result_blocks(dst, blocks, capacity, n);
+    free_temp_blocks(temp, 2 * n);
+}
+
+/*
+ * Multiply two numbers in Montgomery form, storing `a * b / R mod m` (the
+ * Montgomery form of their product) in `dst`. `dst` may be the same Bnum as either
+ * operand. Operands that aren't less than the modulus are reduced first.
+ *
+ * Parameters:  dst     Where to store the result.
+ *              a       Left hand side of the expression.
+ *              b       Right hand side of the expression.
+ *              ctx     The Montgomery context of the modulus.
+ */
+void Bnum_mont_mul(Bnum* dst, Bnum* a, Bnum* b, Bnum_mont_ctx* ctx) {
+    int n = ctx->num_blocks;
+    int temp_size = 4 * n;
+    Block* temp = temp_blocks(temp_size);
+    load_residue(temp, a, ctx->m, n);
+    load_residue(temp + n, b, ctx->m, n);
+
+    int capacity = n;
+    Block* blocks = result_blocks(dst, &capacity, a, b);
+    blocks_mont_mul(blocks, temp, temp + n, ctx, temp + 2 * n);
+    set_result_blocks(dst, blocks, capacity, n);
+    free_temp_blocks(temp, temp_size);
+}
+
+/*
+ * Square a number in Montgomery form, storing `a * a / R mod m` in `dst`. `dst` may
+ * be the same Bnum as `a`. This is faster than `Bnum_mont_mul()` with `a` twice.
+ *
+ * Parameters:  dst     Where to store the result.
+ *              a       The number to square.
+ *              ctx     The Montgomery context of the modulus.
+ */
+void Bnum_mont_sqr(Bnum* dst, Bnum* a, Bnum_mont_ctx* ctx) {
+    int n = ctx->num_blocks;
+    int temp_size = 3 * n;
+    Block* temp = temp_blocks(temp_size);
+    load_residue(temp, a, ctx->m, n);
+
+    int capacity = n;
+    Block* blocks = result_blocks(dst, &capacity, a, a);
+    blocks_mont_mul(blocks, temp, temp, ctx, temp + n);
+    set_result_blocks(dst, blocks, capacity, n);
+    free_temp_blocks(temp, temp_size);
+}
+
+/*
+ * Compute `a` to the power of `e` modulo `m` and return it inside of a new Bnum.
+ * This Bnum should be destroyed by the caller.
+ *
+ * Parameters:  a   The base.
+ *              e   The exponent.
+ *              m   The modulus.
+ *
+ * Returns: A pointer to a new Bnum with value equal to `a^e mod m`, or NULL if `m`
+ *          is zero.
+ */
+Bnum* Bnum_powmod(Bnum* a, Bnum* e, Bnum* m) {
+    if (m->num_blocks == 0) { return NULL; }
+
+    Bnum* result = Bnum_create(0);
+    Bnum_powmod_to(result, a, e, m);
+
+    return result;
+}
+
+/*
+ * Compute `a` to the power of `e` modulo `m` and store it in `dst`. `dst` may be
+ * the same Bnum as any of the arguments.
+ *
+ * Uses left-to-right sliding window exponentiation like `Bnum_pow_to()`, with
+ * windows of up to `POWMOD_WINDOW_MAX` bits. For odd `m` the products are reduced
+ * with Montgomery multiplication (see `Bnum_mont_ctx_create()`), otherwise by
+ * dividing by a precomputed divisor (see `Bnum_divisor_create()`).
+ *
+ * Parameters:  dst     Where to store the result.
+ *              a       The base.
+ *              e       The exponent.
+ *              m       The modulus.
+ *
+ * Returns: 0, or -1 if `m` is zero, in which case `dst` is left unchanged.
+ */
+int Bnum_powmod_to(Bnum* dst, Bnum* a, Bnum* e, Bnum* m) {
+    int n = m->num_blocks;
+    if (n == 0) { return -1; }
+    if (e->num_blocks == 0) {
+        // 1 mod m
+        Bnum_set_u64(dst, !(n == 1 && m->blocks[0] == 1));
+        return 0;
+    }
+
+    int temp_size = 3 * n;
+    Block* temp = temp_blocks(temp_size);
+    load_residue(temp, a, m->blocks, n);
+    Bnum_mont_ctx* ctx = Bnum_mont_ctx_create(m);
+    Bnum_divisor* divisor = ctx ? NULL : Bnum_divisor_create(m);
+
+    // nothing reads `m` from here on, so `dst` may reuse its storage
+    int capacity = n;
+    Block* blocks = result_blocks(dst, &capacity, a, e);
+    if (ctx) {
+        blocks_mont_mul(temp, temp, ctx->r2, ctx, temp + n);
+        blocks_powmod(blocks, temp, e->blocks, e->num_blocks, n, ctx, NULL);
+        memcpy(temp, blocks, n * sizeof(Block));
+        memset(temp + n, 0, n * sizeof(Block));
+        blocks_redc(blocks, temp, ctx);
+        Bnum_mont_ctx_destroy(ctx);
+    }
+    else {
+        blocks_powmod(blocks, temp, e->blocks, e->num_blocks, n, NULL, divisor);
+        Bnum_divisor_destroy(divisor);
+    }
+    set_result_blocks(dst, blocks, capacity, n);
+    free_temp_blocks(temp, temp_size);
+
+    return 0;
+}
+
+/*
+ * Get the current value of one of the library's tuning thresholds, which apply to
+ * operations not given a context.
+ *
+ * Parameters:  which   The threshold to look up.
+ *
+ * Returns: The value of the threshold, or -1 if `which` is not a valid threshold.
+ */
+int Bnum_get_threshold(Bnum_threshold which) {
+    return Bnum_ctx_get_threshold(&default_ctx, which);
+}
+
+/*
+ * Set one of the library's tuning thresholds, e.g. to values measured on the
+ * machine the library is running on. Values below the smallest size the
+ * corresponding algorithm can handle are raised to that size. Contexts created
+ * afterwards start out with the new value.
+ *
+ * Operations size their scratch space by the thresholds, so this must not be
+ * called while another thread may be running an operation without a context.
+ *
+ * Parameters:  which   The threshold to set.
+ *              value   The new value of the threshold, in blocks.
+ */
+void Bnum_set_threshold(Bnum_threshold which, int value) {
+    Bnum_ctx_set_threshold(&default_ctx, which, value);
+}
+
+/*
+ * Get the maximum number of threads a single operation not given a context may
+ * use, see `Bnum_set_max_threads()`.
+ *
+ * Returns: The number of threads, including the calling one.
+ */
+int Bnum_get_max_threads(void) {
+    return atomic_load(&default_ctx.max_threads);
+}
+
+/*
+ * Set the maximum number of threads a single operation not given a context may
+ * use, including the calling one. With the default of 1 everything runs on the
+ * calling thread. With more, multiplications and squarings of at least
+ * BNUM_PARALLEL_THRESHOLD blocks are split across a pool of `threads - 1` worker
+ * threads, which is started when it is first needed: the products of Toom-Cook
+ * multiplication, and the primes, transform halves and carry propagation of
+ * transform multiplication, are run as tasks that idle threads steal from each
+ * other's queues. Every operation that multiplies large numbers (division,
+ * powers, radix conversion) benefits.
+ *
+ * This must not be called while another thread may be running an operation
+ * without a context.
+ *
+ * Parameters:  threads     The number of threads; values below 1 are taken as 1.
+ */
+void Bnum_set_max_threads(int threads) {
+    if (threads < 1) { threads = 1; }
+
+    pthread_mutex_lock(&default_ctx.lock);
+    workers_stop(&default_ctx);
+    atomic_store(&default_ctx.max_threads, threads);
+    pthread_mutex_unlock(&default_ctx.lock);
+}
+
+/*
+ * Create a context to run heavy operations with, through functions such as
+ * `Bnum_mul_ctx()`. A context has its own tuning thresholds, starting out as the
+ * library's current ones (see `Bnum_set_threshold()`), its own pool of worker
+ * threads to split large operations across, and optionally its own functions for
+ * scratch memory. Several threads may run operations with the same context at
+ * once; they then share its workers. The context must be destroyed by the caller,
+ * using `Bnum_ctx_destroy()`.
+ *
+ * Parameters:  threads     The maximum number of threads an operation may use,
+ *                          including the calling one; values below 1 are taken
+ *                          as 1. The `threads - 1` workers are started when they
+ *                          are first needed.
+ *
+ * Returns: A pointer to the new context.
+ */
+Bnum_ctx* Bnum_ctx_create(int threads) {
+    Bnum_ctx* ctx = heap_alloc(sizeof(Bnum_ctx));
+    memset(ctx, 0, sizeof(Bnum_ctx));
+
+    memcpy(ctx->thresholds, default_ctx.thresholds, sizeof(ctx->thresholds));
+    atomic_init(&ctx->max_threads, threads < 1 ? 1 : threads);
+    atomic_init(&ctx->num_threads, 1);
+    atomic_init(&ctx->started, 0);
+    atomic_init(&ctx->helpers, 0);
+    pthread_mutex_init(&ctx->lock, NULL);
+
+    return ctx;
+}
+
+/*
+ * Destroy a context from `Bnum_ctx_create()`, stopping its worker threads and
+ * waiting for any jobs it submitted to an executor to finish. No operation may
+ * be running with the context.
+ *
+ * Parameters:  ctx     The context; may be NULL.
+ */
+void Bnum_ctx_destroy(Bnum_ctx* ctx) {
+    if (!ctx) { return; }
+
+    pthread_mutex_lock(&ctx->lock);
+    workers_stop(ctx);
+    pthread_mutex_unlock(&ctx->lock);
+    pthread_mutex_destroy(&ctx->lock);
+    heap_free(ctx, sizeof(Bnum_ctx));
+}
+
+/*
+ * Make a context split its work across the threads of an external executor, such
+ * as the thread pool of the application, instead of starting worker threads of
+ * its own. For each task an operation spawns, `submit` is called with a job that
+ * runs one of the context's pending tasks, if any are left; a thread waiting for
+ * tasks runs pending ones itself, so the jobs are only a hint and an operation
+ * finishes even if they run late. `submit` and the jobs may be called from any
+ * thread, and the jobs must not run after the context is destroyed, which waits
+ * for them. The context's thread count is taken as the number of executor
+ * threads it may keep busy.
+ *
+ * No operation may be running with the context.
+ *
+ * Parameters:  ctx     The context.
+ *              submit  The function to submit jobs with, or NULL to go back to
+ *                      the context's own worker threads.
+ *              data    Passed to `submit` along with each job.
+ */
+void Bnum_ctx_set_executor(Bnum_ctx* ctx, Bnum_submit_func submit, void* data) {
+    pthread_mutex_lock(&ctx->lock);
+    workers_stop(ctx);
+    ctx->submit = submit;
+    ctx->submit_data = data;
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+/*
+ * Get the current value of one of a context's tuning thresholds.
+ *
+ * Parameters:  ctx     The context.
+ *              which   The threshold to look up.
+ *
+ * Returns: The value of the threshold, or -1 if `which` is not a valid threshold.
+ */
+int Bnum_ctx_get_threshold(Bnum_ctx* ctx, Bnum_threshold which) {
+    if (which < 0 || which >= BNUM_NUM_THRESHOLDS) { return -1; }
+
+    return ctx->thresholds[which];
+}
+
+/*
+ * Set one of a context's tuning thresholds, see `Bnum_set_threshold()`. No
+ * operation may be running with the context.
+ *
+ * Parameters:  ctx     The context.
+ *              which   The threshold to set.
+ *              value   The new value of the threshold, in blocks.
+ */
+void Bnum_ctx_set_threshold(Bnum_ctx* ctx, Bnum_threshold which, int value) {
+    if (which < 0 || which >= BNUM_NUM_THRESHOLDS) { return; }
+
+    if (value < min_thresholds[which]) { value = min_thresholds[which]; }
+    ctx->thresholds[which] = value;
+}
+
+/*
+ * Set the functions a context's operations allocate their large scratch buffers
+ * with, e.g. to draw them from memory set aside per request. Buffers small enough
+ * for the per-thread pool (up to 64 KiB) still come from there, and results are
+ * still allocated like those of any other operation. The functions must be safe
+ * to call from every thread the context's operations run on. No operation may be
+ * running with the context.
+ *
+ * Parameters:  ctx         The context.
+ *              alloc_fn    Allocates a given number of bytes; NULL to use the
+ *                          library's allocation functions again.
+ *              free_fn     Frees memory, given its size.
+ */
+void Bnum_ctx_set_scratch_functions(Bnum_ctx* ctx, Bnum_alloc_func alloc_fn,
+        Bnum_free_func free_fn) {
+    ctx->scratch_alloc = alloc_fn && free_fn ? alloc_fn : NULL;
+    ctx->scratch_free = alloc_fn && free_fn ? free_fn : NULL;
+}
+
+/*
+ * Compute `r = a * b` with a context, see `Bnum_mul_to()`.
+ */
+void Bnum_mul_ctx(Bnum* r, Bnum* a, Bnum* b, Bnum_ctx* ctx) {
+    Bnum_ctx* saved = ctx_enter(ctx);
+    Bnum_mul_to(r, a, b);
+    pool.ctx = saved;
+}
+
+/*
+ * Compute `r = a * a` with a context, see `Bnum_sqr_to()`.
+ */
+void Bnum_sqr_ctx(Bnum* r, Bnum* a, Bnum_ctx* ctx) {
+    Bnum_ctx* saved = ctx_enter(ctx);
+    Bnum_sqr_to(r, a);
+    pool.ctx = saved;
+}
+
+/*
+ * Compute `r = a^n` with a context, see `Bnum_pow_to()`.
+ */
+int Bnum_pow_ctx(Bnum* r, Bnum* a, int n, Bnum_ctx* ctx) {
+    Bnum_ctx* saved = ctx_enter(ctx);
+    int result = Bnum_pow_to(r, a, n);
+    pool.ctx = saved;
+
+    return result;
+}
+
+/*
+ * Divide with a context, see `Bnum_divmod()`.
+ */
+int Bnum_divmod_ctx(Bnum* q, Bnum* r, Bnum* a, Bnum* b, Bnum_ctx* ctx) {
+    Bnum_ctx* saved = ctx_enter(ctx);
+    int result = Bnum_divmod(q, r, a, b);
+    pool.ctx = saved;
+
+    return result;
+}
+
+/*
+ * Compute a modular power with a context, see `Bnum_powmod_to()`.
+ */
+int Bnum_powmod_ctx(Bnum* r, Bnum* b, Bnum* e, Bnum* m, Bnum_ctx* ctx) {
+    Bnum_ctx* saved = ctx_enter(ctx);
+    int result = Bnum_powmod_to(r, b, e, m);
+    pool.ctx = saved;
+
+    return result;
+}
+
+/*
+ * Convert to a string with a context, see `Bnum_to_str()`.
+ */
+char* Bnum_to_str_ctx(char* str, int base, Bnum* x, Bnum_ctx* ctx) {
+    Bnum_ctx* saved = ctx_enter(ctx);
+    char* result = Bnum_to_str(str, base, x);
+    pool.ctx = saved;
+
+    return result;
+}
+
+/*
+ * Parse a string with a context, see `Bnum_from_str()`.
+ */
+Bnum* Bnum_from_str_ctx(const char* str, size_t len, int base, Bnum_ctx* ctx) {
+    Bnum_ctx* saved = ctx_enter(ctx);
+    Bnum* result = Bnum_from_str(str, len, base);
+    pool.ctx = saved;
+
+    return result;
+}
+
+/*
+ * Begin a new arena on the calling thread. Until it is released, every Bnum the
+ * thread creates (including the results of functions like `Bnum_mult()`) is
+ * allocated from the arena, and `Bnum_destroy()` does nothing for it; the arena
+ * frees all of them at once when it is released. This makes short-lived
+ * temporaries nearly free to create and destroy.
+ *
+ * Arenas nest: beginning an arena while another is current makes the new one
+ * current until it is released. Bnums keep using the arena they were created in
+ * when they grow, even while a different arena is current. Other threads may read
+ * an arena's Bnums, but only the thread that began it may modify them.
+ *
+ * Returns: The new arena, which must be released on the same thread with
+ *          `Bnum_arena_release()`.
+ */
+Bnum_arena* Bnum_arena_begin(void) {
+    ArenaChunk* chunk = arena_new_chunk(ARENA_CHUNK_SIZE);
+
+    // the arena itself lives at the start of its first chunk
+    Bnum_arena* arena = (Bnum_arena*) ((char*) chunk + ARENA_ROUND(sizeof(ArenaChunk)));
+    arena->chunks = chunk;
+    arena->next = (char*) arena + ARENA_ROUND(sizeof(Bnum_arena));
+    arena->end = (char*) chunk + chunk->size;
+    arena->parent = pool.arena;
+    pool.arena = arena;
+
+    return arena;
+}
+
+/*
+ * Release an arena, freeing every Bnum that was allocated from it; none of them
+ * may be used afterwards. Any arenas begun after `arena` that are still current
+ * are released as well, and the arena that was current when `arena` began
+ * becomes current again.
+ *
+ * Parameters:  arena   The arena to release, from `Bnum_arena_begin()` on the
+ *                      calling thread.
+ */
+void Bnum_arena_release(Bnum_arena* arena) {
+    while (pool.arena != arena) { Bnum_arena_release(pool.arena); }
+
+    pool.arena = arena->parent;
+    for (ArenaChunk* chunk = arena->chunks; chunk;) {
+        ArenaChunk* next = chunk->next;
+        if (chunk->size == ARENA_CHUNK_SIZE && pool.num_spare < ARENA_MAX_SPARE) {
+            chunk->next = pool.spare_chunks;
+            pool.spare_chunks = chunk;
+            pool.num_spare++;
+        }
+        else {
+            heap_free(chunk, chunk->size);
+        }
+        chunk = next;
+    }
+}
+
+/*
+ * Free all memory the calling thread is keeping around for reuse. Block storage
+ * and temporary buffers freed by the library are cached per thread, so that
+ * later allocations of the same size don't have to go through the allocation
+ * functions; the cache is trimmed automatically when the thread exits. This also
+ * frees the powers cached by `Bnum_to_str()` and `Bnum_from_str()`.
+ */
+void Bnum_pool_trim(void) {
+    if (pool.tower) {
+        tower_free(pool.tower);
+        pool.tower = NULL;
+    }
+    for (int i = 0; i < POOL_CLASSES; i++) {
+        while (pool.free_lists[i]) {
+            FreeBuffer* buffer = pool.free_lists[i];
+            pool.free_lists[i] = buffer->next;
+            heap_free(buffer, (size_t) 1 << (i + POOL_MIN_LOG));
+        }
+        pool.num_free[i] = 0;
+    }
+    while (pool.spare_chunks) {
+        ArenaChunk* chunk = pool.spare_chunks;
+        pool.spare_chunks = chunk->next;
+        heap_free(chunk, chunk->size);
+    }
+    pool.num_spare = 0;
+}
+
+/*
+ * Get the allocation counters of the calling thread, counting since the thread
+ * started or since the last call to `Bnum_reset_alloc_stats()`.
+ *
+ * Parameters:  stats   Where to store the counters.
+ */
+void Bnum_get_alloc_stats(Bnum_alloc_stats* stats) {
+    *stats = pool.stats;
+}
+
+/*
+ * Reset the allocation counters of the calling thread to zero.
+ */
+void Bnum_reset_alloc_stats(void) {
+    memset(&pool.stats, 0, sizeof(pool.stats));
+}
+
+/*
+ * Replace the functions the library allocates all of its memory with, e.g. to
+ * use a different allocator. Every allocation goes through them, including the
+ * temporary buffers used inside operations, and the free and realloc functions
+ * are given the size the memory was allocated with. Passing NULL for a function
+ * restores the default for it, which uses malloc(), realloc() or free().
+ *
+ * This should be called before any Bnum is created, and before other threads use
+ * the library: memory allocated with the old functions must not be in use when
+ * they are replaced. The calling thread's
+ * cached memory (see `Bnum_pool_trim()`) is freed with the old functions first.
+ *
+ * Parameters:  alloc_fn    Allocates a given number of bytes.
+ *              realloc_fn  Resizes memory, given its old and new size.
+ *              free_fn     Frees memory, given its size.
+ */
+void Bnum_set_memory_functions(Bnum_alloc_func alloc_fn, Bnum_realloc_func realloc_fn,
+        Bnum_free_func free_fn) {
+    Bnum_pool_trim();
+
+    alloc_func = alloc_fn ? alloc_fn : default_alloc;
+    realloc_func = realloc_fn ? realloc_fn : default_realloc;
+    free_func = free_fn ? free_fn : default_free;
+}
+
+/*
+ * Get the functions the library currently allocates its memory with.
+ *
+ * Parameters:  alloc_fn    Where to store the allocation function; may be NULL.
+ *              realloc_fn  Where to store the reallocation function; may be NULL.
+ *              free_fn     Where to store the free function; may be NULL.
+ */
+void Bnum_get_memory_functions(Bnum_alloc_func* alloc_fn, Bnum_realloc_func* realloc_fn,
+        Bnum_free_func* free_fn) {
+    if (alloc_fn) { *alloc_fn = alloc_func; }
+    if (realloc_fn) { *realloc_fn = realloc_func; }
+    if (free_fn) { *free_fn = free_func; }
+}
+
+
+/* ---------- Helper Functions ---------- */
+
+/*
+ * Add a new Block to a Bnum such that the newly added block is the most numerically
+ * significant.
+ *
+ * Parameters:  big_num     The Bnum to add to.
+ *              val         Value to be stored in the new Block.
+ */
+void add_block(Bnum* big_num, Block val) {
+    if (big_num->num_blocks == big_num->capacity) {
+        reserve_blocks(big_num, 2 * big_num->capacity + 1);
+    }
+
+    big_num->blocks[big_num->num_blocks++] = val;
+}
+
+/*
+ * Make sure a Bnum has room for at least `num_blocks` blocks, growing its block
+ * array if necessary. Existing blocks are preserved.
+ *
+ * Parameters:  big_num     The Bnum to grow.
+ *              num_blocks  The number of blocks it must be able to hold.
+ */
+static void reserve_blocks(Bnum* big_num, int num_blocks) {
+    if (num_blocks <= big_num->capacity) { return; }
+
+    // storage too large for the pool can be resized in place
+    size_t old_size = (size_t) big_num->capacity * sizeof(Block);
+    size_t new_size = (size_t) num_blocks * sizeof(Block);
+    if (!big_num->arena && pool_class(old_size) < 0) {
+        big_num->blocks = heap_realloc(big_num->blocks, old_size, new_size);
+        big_num->capacity = num_blocks;
+        return;
+    }
+
+    int capacity = num_blocks;
+    Block* blocks = alloc_blocks(big_num, &capacity);
+    if (big_num->num_blocks > 0) {
+        memcpy(blocks, big_num->blocks, big_num->num_blocks * sizeof(Block));
+    }
+    free_blocks(big_num, big_num->blocks, big_num->capacity);
+    big_num->blocks = blocks;
+    big_num->capacity = capacity;
+}
+
+/*
+ * Get a block array with room for `*capacity` blocks to compute a result for
+ * `dst` into, for operations whose result must not overlap their inputs `a` and
+ * `b`. This is the storage of `dst` itself if it is large enough and is not
+ * shared with an input, and a new array from `dst`'s allocator otherwise. The
+ * current value of `dst` is not preserved.
+ *
+ * Parameters:  dst         The Bnum the result is for.
+ *              capacity    The number of blocks the array must be able to hold;
+ *                          set to the number it actually has room for.
+ *              a, b        The inputs of the operation.
+ *
+ * Returns: The block array; pass it to `set_result_blocks()` once it holds the
+ *          result.
+ */
+static Block* result_blocks(Bnum* dst, int* capacity, Bnum* a, Bnum* b) {
+    if (dst != a && dst != b && dst->capacity >= *capacity) {
+        *capacity = dst->capacity;
+        return dst->blocks;
+    }
+
+    return alloc_blocks(dst, capacity);
+}
+
+/*
+ * Store a result computed into a block array from `result_blocks()` in `dst`,
+ * freeing the old storage of `dst` if the array is a new one.
+ *
+ * Parameters:  dst         The Bnum to store the result in.
+ *              blocks      The block array holding the result.
+ *              capacity    The number of blocks the array has room for.
+ *              num_blocks  The number of blocks of the (unnormalized) result.
+ */
+static void set_result_blocks(Bnum* dst, Block* blocks, int capacity, int num_blocks) {
+    if (blocks != dst->blocks) {
+        free_blocks(dst, dst->blocks, dst->capacity);
+        dst->blocks = blocks;
+        dst->capacity = capacity;
+    }
+    dst->num_blocks = num_blocks;
+    normalize(dst);
+}
+
+/*
+ * Divide `a` by either `b` or a precomputed divisor (whichever isn't NULL), storing
+ * the quotient in `q` and the remainder in `r` as described for `Bnum_divmod()`.
+ * The divisor must not be zero.
+ *
+ * Parameters:  q           Where to store the quotient, or NULL.
+ *              r           Where to store the remainder, or NULL.
+ *              a           The dividend.
+ *              b           The divisor, or NULL.
+ *              divisor     The precomputed divisor, or NULL.
+ */
+static void divmod(Bnum* q, Bnum* r, Bnum* a, Bnum* b, const Bnum_divisor* divisor) {
+    int an = a->num_blocks;
+    int bn = divisor ? divisor->num_blocks : b->num_blocks;
+    if (an < bn) {
+        // set `r` first, as `q` may be `a`
+        if (r) { Bnum_set(r, a); }
+        if (q) { q->num_blocks = 0; }
+        return;
+    }
+
+    int qn = an - bn + 1;
+    int q_capacity = qn;
+    int r_capacity = bn;
+    Block* q_blocks = q ? result_blocks(q, &q_capacity, a, b) : temp_blocks(qn);
+    Block* r_blocks = r ? result_blocks(r, &r_capacity, a, b) : temp_blocks(bn);
+    if (divisor) { divisor_divrem(q_blocks, r_blocks, a->blocks, an, divisor); }
+    else { blocks_divrem(q_blocks, r_blocks, a->blocks, an, b->blocks, bn); }
+
+    if (q) { set_result_blocks(q, q_blocks, q_capacity, qn); }
+    else { free_temp_blocks(q_blocks, qn); }
+    if (r) { set_result_blocks(r, r_blocks, r_capacity, bn); }
+    else { free_temp_blocks(r_blocks, bn); }
+}
+
+/*
+ * Exchange two block arrays along with their capacities.
+ *
+ * Parameters:  a, a_capacity  The first array and its capacity.
+ *              b, b_capacity  The second array and its capacity.
+ */
+static void swap_buffers(Block** a, int* a_capacity, Block** b, int* b_capacity) {
+    Block* temp = *a; *a = *b; *b = temp;
+    int temp_capacity = *a_capacity; *a_capacity = *b_capacity; *b_capacity = temp_capacity;
+}
+
+/*
+ * Drop any zero blocks from the most significant end of a Bnum, so that its most
+ * significant block (if any) is nonzero.
+ *
+ * Parameters:  big_num     The Bnum to normalize.
+ */
+static void normalize(Bnum* big_num) {
+    while (big_num->num_blocks > 0 && big_num->blocks[big_num->num_blocks - 1] == 0) {
+        big_num->num_blocks--;
+    }
+}
+
+/*
+ * Compare the values of `a` and `b`.
+ *
+ * Parameters:  a   Left hand side of the comparison.
+ *              b   Right hand side of the comparison.
+ *
+ * Returns: A negative value if `a < b`, zero if `a == b` and a positive value
+ *          if `a > b`.
+ */
+static int compare(Bnum* a, Bnum* b) {
+    if (a->num_blocks != b->num_blocks) { return a->num_blocks < b->num_blocks ? -1 : 1; }
+
+    for (int i = a->num_blocks - 1; i >= 0; i--) {
+        if (a->blocks[i] != b->blocks[i]) {
+            return a->blocks[i] < b->blocks[i] ? -1 : 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/* ---------- Memory Management ---------- */
+
+/*
+ * Get the index of the pool size class for an allocation of `size` bytes.
+ *
+ * Parameters:  size    The size of the allocation, in bytes.
+ *
+ * Returns: The size class, or -1 if the allocation is too large for the pool.
+ */
+static int pool_class(size_t size) {
+    if (size > (size_t) 1 << POOL_MAX_LOG) { return -1; }
+
+    int c = 0;
+    while (((size_t) 1 << (c + POOL_MIN_LOG)) < size) { c++; }
+
+    return c;
+}
+
+/*
+ * Allocate a buffer of at least `size` bytes, from the calling thread's free
+ * lists if possible. Sizes the pool handles are rounded up to a power of two.
+ *
+ * Parameters:  size    The number of bytes needed.
+ *
+ * Returns: The buffer, to be freed with `mem_free()` and the same `size`.
+ */
+static void* mem_alloc(size_t size) {
+    int c = pool_class(size);
+    if (c >= 0 && pool.free_lists[c]) {
+        FreeBuffer* buffer = pool.free_lists[c];
+        pool.free_lists[c] = buffer->next;
+        pool.num_free[c]--;
+        pool.stats.pool_hits++;
+        return buffer;
+    }
+
+    return heap_alloc(c >= 0 ? (size_t) 1 << (c + POOL_MIN_LOG) : size);
+}
+
+/*
+ * Free a buffer from `mem_alloc()`, keeping it in the calling thread's free lists
+ * for reuse if there is room.
+ *
+ * Parameters:  ptr     The buffer to free; may be NULL.
+ *              size    The size the buffer was allocated with.
+ */
+static void mem_free(void* ptr, size_t size) {
+    if (!ptr) { return; }
+
+    int c = pool_class(size);
+    if (c >= 0 && pool.num_free[c] < POOL_MAX_FREE) {
+        FreeBuffer* buffer = ptr;
+        buffer->next = pool.free_lists[c];
+        pool.free_lists[c] = buffer;
+        pool.num_free[c]++;
+        return;
+    }
+
+    heap_free(ptr, c >= 0 ? (size_t) 1 << (c + POOL_MIN_LOG) : size);
+}
+
+/*
+ * Allocate memory with the current allocation functions.
+ *
+ * Parameters:  size    The number of bytes needed.
+ *
+ * Returns: The memory, to be freed with `heap_free()` and the same `size`.
+ */
+static void* heap_alloc(size_t size) {
+    pool_register();
+    pool.stats.heap_allocs++;
+
+    return alloc_func(size);
+}
+
+/*
+ * Resize memory from `heap_alloc()` with the current allocation functions,
+ * preserving its contents.
+ *
+ * Parameters:  ptr         The memory to resize.
+ *              old_size    The size it was allocated with.
+ *              new_size    The size it should have.
+ *
+ * Returns: The resized memory, which may have moved.
+ */
+static void* heap_realloc(void* ptr, size_t old_size, size_t new_size) {
+    pool.stats.heap_allocs++;
+    pool.stats.heap_frees++;
+
+    return realloc_func(ptr, old_size, new_size);
+}
+
+/*
+ * Free memory from `heap_alloc()` with the current allocation functions.
+ *
+ * Parameters:  ptr     The memory to free.
+ *              size    The size it was allocated with.
+ */
+static void heap_free(void* ptr, size_t size) {
+    pool.stats.heap_frees++;
+    free_func(ptr, size);
+}
+
+/*
+ * The default allocation functions, which use the C library's allocator.
+ */
+static void* default_alloc(size_t size) {
+    return malloc(size);
+}
+
+static void* default_realloc(void* ptr, size_t old_size, size_t new_size) {
+    (void) old_size;
+
+    return realloc(ptr, new_size);
+}
+
+static void default_free(void* ptr, size_t size) {
+    (void) size;
+    free(ptr);
+}
+
+/*
+ * Make sure the calling thread's pool is trimmed when the thread exits.
+ */
+static void pool_register(void) {
+    if (pool.registered) { return; }
+
+    pthread_once(&pool_key_once, pool_create_key);
+    pthread_setspecific(pool_key, &pool);
+    pool.registered = 1;
+}
+
+/*
+ * Create the thread-specific key whose destructor trims each thread's pool.
+ */
+static void pool_create_key(void) {
+    pthread_key_create(&pool_key, pool_thread_exit);
+}
+
+/*
+ * Trim the pool of a thread that is exiting.
+ *
+ * Parameters:  unused  The value associated with the key.
+ */
+static void pool_thread_exit(void* unused) {
+    (void) unused;
+    Bnum_pool_trim();
+    pool.registered = 0;
+}
+
+/*
+ * Allocate `size` bytes from an arena, adding a chunk to it if the current one
+ * is full.
+ *
+ * Parameters:  arena   The arena to allocate from.
+ *              size    The number of bytes needed.
+ *
+ * Returns: The allocated memory, which lives until the arena is released.
+ */
+static void* arena_alloc(Bnum_arena* arena, size_t size) {
+    size = ARENA_ROUND(size);
+    if ((size_t) (arena->end - arena->next) >= size) {
+        void* ptr = arena->next;
+        arena->next += size;
+        return ptr;
+    }
+
+    size_t header = ARENA_ROUND(sizeof(ArenaChunk));
+    if (size > ARENA_CHUNK_SIZE / 4) {
+        // large requests get a chunk of their own, leaving the current one
+        // to carry on serving small requests
+        ArenaChunk* chunk = arena_new_chunk(header + size);
+        chunk->next = arena->chunks->next;
+        arena->chunks->next = chunk;
+        return (char*) chunk + header;
+    }
+
+    ArenaChunk* chunk = arena_new_chunk(ARENA_CHUNK_SIZE);
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->next = (char*) chunk + header + size;
+    arena->end = (char*) chunk + chunk->size;
+
+    return (char*) chunk + header;
+}
+
+/*
+ * Get a chunk of `size` bytes for an arena, reusing one of the calling thread's
+ * spare chunks if possible.
+ *
+ * Parameters:  size    The size of the chunk, including its header.
+ *
+ * Returns: The chunk, not linked to any arena.
+ */
+static ArenaChunk* arena_new_chunk(size_t size) {
+    ArenaChunk* chunk;
+    if (size == ARENA_CHUNK_SIZE && pool.spare_chunks) {
+        chunk = pool.spare_chunks;
+        pool.spare_chunks = chunk->next;
+        pool.num_spare--;
+        pool.stats.pool_hits++;
+    }
+    else {
+        chunk = heap_alloc(size);
+        chunk->size = size;
+    }
+    chunk->next = NULL;
+
+    return chunk;
+}
+
+/*
+ * Allocate block storage for a Bnum, from its arena if it has one and from the
+ * pool otherwise.
+ *
+ * Parameters:  owner       The Bnum the storage is for.
+ *              capacity    The number of blocks needed; set to the number of
+ *                          blocks the storage actually has room for.
+ *
+ * Returns: The block array, to be freed with `free_blocks()`.
+ */
+static Block* alloc_blocks(Bnum* owner, int* capacity) {
+    size_t size = (size_t) *capacity * sizeof(Block);
+    if (owner->arena) {
+        pool.stats.arena_allocs++;
+        return arena_alloc(owner->arena, size);
+    }
+
+    int c = pool_class(size);
+    if (c >= 0) { *capacity = (int) (((size_t) 1 << (c + POOL_MIN_LOG)) / sizeof(Block)); }
+
+    return mem_alloc(size);
+}
+
+/*
+ * Free block storage from `alloc_blocks()`. Storage from an arena is only
+ * freed when the arena is released, and a Bnum's inline blocks are never freed.
+ *
+ * Parameters:  owner       The Bnum the storage was allocated for.
+ *              blocks      The block array; may be NULL.
+ *              capacity    The capacity `alloc_blocks()` reported for it.
+ */
+static void free_blocks(Bnum* owner, Block* blocks, int capacity) {
+    if (owner->arena || blocks == owner->inline_blocks) { return; }
+
+    mem_free(blocks, (size_t) capacity * sizeof(Block));
+}
+
+/*
+ * Allocate a temporary block array for use inside a single operation. These
+ * always come from the pool, or the context's scratch functions, even while an
+ * arena is current.
+ *
+ * Parameters:  num_blocks  The number of blocks needed.
+ *
+ * Returns: The block array, to be freed with `free_temp_blocks()`.
+ */
+static Block* temp_blocks(int num_blocks) {
+    return scratch_alloc((size_t) num_blocks * sizeof(Block));
+}
+
+/*
+ * Free a temporary block array from `temp_blocks()`.
+ *
+ * Parameters:  blocks      The block array.
+ *              num_blocks  The number of blocks it was allocated with.
+ */
+static void free_temp_blocks(Block* blocks, int num_blocks) {
+    scratch_free(blocks, (size_t) num_blocks * sizeof(Block));
+}
+
+/*
+ * Allocate a scratch buffer for use inside a single operation: from the current
+ * context's scratch functions if it has them and the buffer is too large for the
+ * pool, and with `mem_alloc()` otherwise.
+ *
+ * Parameters:  size    The number of bytes needed.
+ *
+ * Returns: The buffer, to be freed with `scratch_free()` and the same `size`, in
+ *          the same context.
+ */
+static void* scratch_alloc(size_t size) {
+    Bnum_ctx* ctx = current_ctx();
+    if (ctx->scratch_alloc && pool_class(size) < 0) { return ctx->scratch_alloc(size); }
+
+    return mem_alloc(size);
+}
+
+/*
+ * Free a buffer from `scratch_alloc()`.
+ *
+ * Parameters:  ptr     The buffer to free; may be NULL.
+ *              size    The size the buffer was allocated with.
+ */
+static void scratch_free(void* ptr, size_t size) {
+    Bnum_ctx* ctx = current_ctx();
+    if (ctx->scratch_free && pool_class(size) < 0) {
+        if (ptr) { ctx->scratch_free(ptr, size); }
+        return;
+    }
+
+    mem_free(ptr, size);
+}
+
+
+/* ---------- Threads ---------- */
+
+/*
+ * Operations split their work into tasks with `task_spawn()` and collect them with
+ * `task_wait()`, which runs other tasks while it waits, so threads never block on
+ * one another and tasks can spawn tasks of their own. Tasks belong to the context
+ * of the operation that spawned them. Every thread in a context's pool has its
+ * own queue of tasks; threads with nothing to do steal from the others. A context
+ * with an external executor has just one queue, and submits a job to run a task
+ * from it for every task spawned.
+ */
+
+/*
+ * Get the context the calling thread's operation runs with.
+ */
+static Bnum_ctx* current_ctx(void) {
+    return pool.ctx ? pool.ctx : &default_ctx;
+}
+
+/*
+ * Make `ctx` the calling thread's context, for the `Bnum_*_ctx()` functions.
+ *
+ * Returns: The previous context, to be restored into `pool.ctx` afterwards.
+ */
+static Bnum_ctx* ctx_enter(Bnum_ctx* ctx) {
+    Bnum_ctx* saved = pool.ctx;
+    pool.ctx = ctx;
+
+    return saved;
+}
+
+/*
+ * Get one of the current context's tuning thresholds.
+ */
+static int get_threshold(Bnum_threshold which) {
+    return current_ctx()->thresholds[which];
+}
+
+/*
+ * Determine whether work on numbers of `size` blocks should be split across
+ * threads, starting the current context's workers if they aren't running yet.
+ */
+static int use_threads(int size) {
+    Bnum_ctx* ctx = current_ctx();
+    if (size < ctx->thresholds[BNUM_PARALLEL_THRESHOLD] || atomic_load(&ctx->max_threads) < 2) {
+        return 0;
+    }
+    if (!atomic_load(&ctx->started)) { workers_start(ctx); }
+
+    return atomic_load(&ctx->num_threads) > 1;
+}
+
+/*
+ * Start the worker pool of a context with `max_threads - 1` workers, or just the
+ * task queue if it uses an external executor, unless this has been done already.
+ * If not all the threads can be created, the pool runs with those that could.
+ */
+static void workers_start(Bnum_ctx* ctx) {
+    pthread_mutex_lock(&ctx->lock);
+    if (atomic_load(&ctx->started)) {
+        pthread_mutex_unlock(&ctx->lock);
+        return;
+    }
+
+    Workers* w = &ctx->workers;
+    int threads = atomic_load(&ctx->max_threads);
+    int n = ctx->submit ? 1 : threads;
+    w->queues = heap_alloc(n * sizeof(TaskQueue));
+    w->threads = n > 1 ? heap_alloc((n - 1) * sizeof(pthread_t)) : NULL;
+    for (int i = 0; i < n; i++) {
+        pthread_mutex_init(&w->queues[i].lock, NULL);
+        w->queues[i].head = 0;
+        w->queues[i].tail = 0;
+    }
+    atomic_store(&w->next_index, 1);
+    atomic_store(&w->pending, 0);
+    atomic_store(&w->sleeping, 0);
+    w->stop = 0;
+    pthread_mutex_init(&w->sleep_lock, NULL);
+    pthread_cond_init(&w->wake, NULL);
+
+    // workers must not look at the other queues before `num_queues` covers them,
+    // so they wait for the lock; there are no tasks for them yet anyway
+    int created = 0;
+    pthread_mutex_lock(&w->sleep_lock);
+    while (created < n - 1) {
+        if (pthread_create(&w->threads[created], NULL, worker_main, ctx) != 0) { break; }
+        created++;
+    }
+    w->num_queues = n;
+    w->num_workers = created;
+    pthread_mutex_unlock(&w->sleep_lock);
+
+    atomic_store(&ctx->num_threads, ctx->submit ? threads : created + 1);
+    atomic_store(&ctx->started, 1);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+/*
+ * Stop the worker pool of a context, if it is running, and wait for its threads
+ * and the jobs it submitted to an executor to finish. No tasks may be in flight.
+ * `ctx->lock` must be held.
+ */
+static void workers_stop(Bnum_ctx* ctx) {
+    Workers* w = &ctx->workers;
+    while (atomic_load(&ctx->helpers) > 0) { sched_yield(); }
+    if (!w->queues) {
+        atomic_store(&ctx->started, 0);
+        return;
+    }
+
+    int n = w->num_queues;
+    pthread_mutex_lock(&w->sleep_lock);
+    w->stop = 1;
+    pthread_cond_broadcast(&w->wake);
+    pthread_mutex_unlock(&w->sleep_lock);
+    for (int i = 0; i < w->num_workers; i++) { pthread_join(w->threads[i], NULL); }
+
+    for (int i = 0; i < n; i++) { pthread_mutex_destroy(&w->queues[i].lock); }
+    pthread_mutex_destroy(&w->sleep_lock);
+    pthread_cond_destroy(&w->wake);
+    heap_free(w->queues, n * sizeof(TaskQueue));
+    if (w->threads) { heap_free(w->threads, (n - 1) * sizeof(pthread_t)); }
+    w->queues = NULL;
+    w->threads = NULL;
+    w->num_queues = 0;
+    w->num_workers = 0;
+    atomic_store(&ctx->num_threads, 1);
+    atomic_store(&ctx->started, 0);
+}
+
+/*
+ * Main loop of a worker thread: run tasks while there are any, and sleep until
+ * more are spawned otherwise.
+ *
+ * Parameters:  arg     The context the worker belongs to.
+ */
+static void* worker_main(void* arg) {
+    Bnum_ctx* ctx = arg;
+    Workers* w = &ctx->workers;
+    worker_ctx = ctx;
+    worker_index = atomic_fetch_add(&w->next_index, 1);
+
+    for (;;) {
+        pthread_mutex_lock(&w->sleep_lock);
+        atomic_fetch_add(&w->sleeping, 1);
+        while (!w->stop && atomic_load(&w->pending) == 0) {
+            pthread_cond_wait(&w->wake, &w->sleep_lock);
+        }
+        atomic_fetch_sub(&w->sleeping, 1);
+        int stop = w->stop;
+        pthread_mutex_unlock(&w->sleep_lock);
+        if (stop) { break; }
+
+        Task* task;
+        while ((task = task_take(ctx))) { task_run(task); }
+    }
+
+    return NULL;
+}
+
+/*
+ * Job submitted to a context's external executor: run one of its pending tasks,
+ * if there are any left.
+ *
+ * Parameters:  arg     The context.
+ */
+static void executor_help(void* arg) {
+    Bnum_ctx* ctx = arg;
+
+    Task* task = task_take(ctx);
+    if (task) { task_run(task); }
+    atomic_fetch_sub(&ctx->helpers, 1);
+}
+
+/*
+ * Queue `task` in the current context, for any thread working for it to run, and
+ * wake a sleeping worker or submit a job to the executor. The task must stay
+ * alive until `task_wait()` has returned for it. If the queue is full, the task
+ * is run right away.
+ */
+static void task_spawn(Task* task) {
+    Bnum_ctx* ctx = current_ctx();
+    Workers* w = &ctx->workers;
+    task->ctx = ctx;
+    atomic_store(&task->done, 0);
+
+    TaskQueue* queue = &w->queues[worker_ctx == ctx ? worker_index : 0];
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail - queue->head == TASK_QUEUE_SIZE) {
+        pthread_mutex_unlock(&queue->lock);
+        task_run(task);
+        return;
+    }
+    queue->tasks[queue->tail++ % TASK_QUEUE_SIZE] = task;
+    atomic_fetch_add(&w->pending, 1);
+    pthread_mutex_unlock(&queue->lock);
+
+    if (ctx->submit) {
+        atomic_fetch_add(&ctx->helpers, 1);
+        ctx->submit(executor_help, ctx, ctx->submit_data);
+    }
+    // a worker going to sleep counts itself before it checks `pending`, so either
+    // it sees the task or it is seen here
+    else if (atomic_load(&w->sleeping) > 0) {
+        pthread_mutex_lock(&w->sleep_lock);
+        pthread_cond_signal(&w->wake);
+        pthread_mutex_unlock(&w->sleep_lock);
+    }
+}
+
+/*
+ * Wait for a task from `task_spawn()` to finish, running queued tasks meanwhile.
+ */
+static void task_wait(Task* task) {
+    while (!atomic_load(&task->done)) {
+        Task* other = task_take(task->ctx);
+        if (other) { task_run(other); }
+        else { sched_yield(); }
+    }
+}
+
+/*
+ * Take a task of a context to run: the newest one from the calling thread's
+ * queue, or else the oldest one from another queue.
+ *
+ * Returns: The task, or NULL if all the queues are empty.
+ */
+static Task* task_take(Bnum_ctx* ctx) {
+    Workers* w = &ctx->workers;
+    int n = w->num_queues;
+    int own = worker_ctx == ctx ? worker_index : 0;
+    Task* task = NULL;
+
+    for (int i = 0; i < n && !task; i++) {
+        TaskQueue* queue = &w->queues[(own + i) % n];
+        pthread_mutex_lock(&queue->lock);
+        if (queue->tail != queue->head) {
+            task = i == 0 ? queue->tasks[--queue->tail % TASK_QUEUE_SIZE] :
+                queue->tasks[queue->head++ % TASK_QUEUE_SIZE];
+            atomic_fetch_sub(&w->pending, 1);
+        }
+        pthread_mutex_unlock(&queue->lock);
+    }
+
+    return task;
+}
+
+/*
+ * Run a task in its context and mark it done.
+ */
+static void task_run(Task* task) {
+    Bnum_ctx* saved = ctx_enter(task->ctx);
+    task->run(task);
+    pool.ctx = saved;
+    atomic_store(&task->done, 1);
+}
+
+/*
+ * Run `count` independent tasks: spread across threads if `parallel` is nonzero,
+ * with the first one on the calling thread, or one after the other otherwise.
+ */
+static void run_tasks(Task** tasks, int count, int parallel) {
+    if (!parallel) {
+        for (int i = 0; i < count; i++) { tasks[i]->run(tasks[i]); }
+        return;
+    }
+
+    for (int i = 1; i < count; i++) { task_spawn(tasks[i]); }
+    tasks[0]->run(tasks[0]);
+    for (int i = count - 1; i >= 1; i--) { task_wait(tasks[i]); }
+}
+
+/*
+ * Run a `MulTask`, computing `r = a * b` with `blocks_mul()`.
+ */
+static void mul_task_run(Task* task) {
+    MulTask* product = (MulTask*) task;
+    blocks_mul(product->r, product->a, product->an, product->b, product->bn);
+}
+
+
+/* ---------- Block Array Functions ---------- */
+
+/*
+ * The functions below operate directly on arrays of blocks, least significant
+ * first, rather than on Bnums. They never allocate and never normalize; sizes are
+ * always given explicitly. Unless stated otherwise, the result may share memory
+ * with an input only if it starts at exactly the same block.
+ */
+
+/*
+ * Compute `r = a + b`, where `a` has `an` blocks and `b` has `bn <= an` blocks.
+ * `r` must have room for `an` blocks.
+ *
+ * Returns: The carry out of the most significant block (0 or 1).
+ */
+static Block blocks_add(Block* r, const Block* a, int an, const Block* b, int bn) {
+    DBlock carry = 0;
+    int i = 0;
+
+    for (; i < bn; i++) {
+        carry += (DBlock) a[i] + b[i];
+        r[i] = (Block) carry;
+        carry >>= BLOCK_SIZE;
+    }
+    // propagate the carry only as far as it goes; the rest is a plain copy,
+    // which in-place additions of a short `b` can skip entirely
+    for (; i < an && carry; i++) {
+        carry += a[i];
+        r[i] = (Block) carry;
+        carry >>= BLOCK_SIZE;
+    }
+    if (r != a && i < an) { memcpy(r + i, a + i, (an - i) * sizeof(Block)); }
+
+    return (Block) carry;
+}
+
+/*
+ * Compute `r = a - b`, where `a` has `an` blocks and `b` has `bn <= an` blocks.
+ * `r` must have room for `an` blocks.
+ *
+ * Returns: The borrow out of the most significant block (0 or 1); 1 means that
+ *          `b > a` and `r` holds `a - b + 2^(an * BLOCK_SIZE)`.
+ */
+static Block blocks_sub(Block* r, const Block* a, int an, const Block* b, int bn) {
+    Block borrow = 0;
+    int i = 0;
+
+    for (; i < bn; i++) {
+        Block diff = a[i] - b[i];
+        Block next = (a[i] < b[i]) | (diff < borrow);
+        r[i] = diff - borrow;
+        borrow = next;
+    }
+    // as in blocks_add(), the borrow usually stops after a block or two
+    for (; i < an && borrow; i++) {
+        borrow = a[i] == 0;
+        r[i] = a[i] - 1;
+    }
+    if (r != a && i < an) { memcpy(r + i, a + i, (an - i) * sizeof(Block)); }
+
+    return borrow;
+}
+
+/*
+ * Compute `r = -a` modulo 2^(n * BLOCK_SIZE), i.e. the two's complement negation
+ * of `a`, where `a` and `r` have `n` blocks.
+ */
+static void blocks_neg(Block* r, const Block* a, int n) {
+    Block borrow = 0;
+
+    for (int i = 0; i < n; i++) {
+        r[i] = 0 - a[i] - borrow;
+        borrow |= a[i] != 0;
+    }
+}
+
+/*
+ * Compute `r = a * b`, where `a` has `n` blocks and `b` is a single block. `r`
+ * must have room for `n` blocks.
+ *
+ * Returns: The most significant block of the product, which does not fit in `r`.
+ */
+static Block blocks_mul_1(Block* r, const Block* a, int n, Block b) {
+    DBlock carry = 0;
+
+    for (int i = 0; i < n; i++) {
+        carry += (DBlock) a[i] * b;
+        r[i] = (Block) carry;
+        carry >>= BLOCK_SIZE;
+    }
+
+    return (Block) carry;
+}
+
+/*
+ * Compute `r = r + a * b`, where `a` and `r` have `n` blocks and `b` is a single
+ * block.
+ *
+ * Returns: The block carried out of the most significant end of `r`.
+ */
+static Block blocks_addmul_1(Block* r, const Block* a, int n, Block b) {
+    DBlock carry = 0;
+
+    for (int i = 0; i < n; i++) {
+        carry += (DBlock) a[i] * b + r[i];
+        r[i] = (Block) carry;
+        carry >>= BLOCK_SIZE;
+    }
+
+    return (Block) carry;
+}
+
+/*
+ * Compare two block arrays of the same length `n`.
+ *
+ * Returns: A negative value if `a < b`, zero if `a == b` and a positive value
+ *          if `a > b`.
+ */
+static int blocks_cmp(const Block* a, const Block* b, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+        if (a[i] != b[i]) { return a[i] < b[i] ? -1 : 1; }
+    }
+
+    return 0;
+}
+
+/*
+ * Compute `r = r - a * b`, where `a` and `r` have `n` blocks and `b` is a single
+ * block.
+ *
+ * Returns: The block borrowed out of the most significant block of `r`.
+ */
+static Block blocks_submul_1(Block* r, const Block* a, int n, Block b) {
+    Block borrow = 0;
+
+    for (int i = 0; i < n; i++) {
+        // `high + 1` can't overflow: when `high` is all ones, `low` is zero
+        DBlock product = (DBlock) a[i] * b + borrow;
+        Block low = (Block) product;
+        Block high = (Block) (product >> BLOCK_SIZE);
+        borrow = high + (r[i] < low);
+        r[i] -= low;
+    }
+
+    return borrow;
+}
+
+/*
+ * Compute `r = a + b`, where `a` and `r` have `n >= 1` blocks and `b` is a single
+ * block.
+ *
+ * Returns: The carry out of the most significant block (0 or 1).
+ */
+static Block blocks_add_1(Block* r, const Block* a, int n, Block b) {
+    return blocks_add(r, a, n, &b, 1);
+}
+
+/*
+ * Compute `r = a - b`, where `a` and `r` have `n >= 1` blocks and `b` is a single
+ * block.
+ *
+ * Returns: The borrow out of the most significant block (0 or 1).
+ */
+static Block blocks_sub_1(Block* r, const Block* a, int n, Block b) {
+    return blocks_sub(r, a, n, &b, 1);
+}
+
+/*
+ * Compute `r = a << count` for `0 <= count < BLOCK_SIZE`, where `a` and `r` have
+ * `n` blocks. `r` may be the same array as `a`.
+ *
+ * Returns: The bits shifted out of the most significant block.
+ */
+static Block blocks_lshift(Block* r, const Block* a, int n, int count) {
+    if (count == 0) {
+        memmove(r, a, n * sizeof(Block));
+        return 0;
+    }
+
+    Block out = a[n - 1] >> (BLOCK_SIZE - count);
+    for (int i = n - 1; i > 0; i--) {
+        r[i] = (a[i] << count) | (a[i - 1] >> (BLOCK_SIZE - count));
+    }
+    r[0] = a[0] << count;
+
+    return out;
+}
+
+/*
+ * Compute `r = a >> count` for `0 <= count < BLOCK_SIZE`, where `a` and `r` have
+ * `n` blocks. `r` may be the same array as `a`.
+ */
+static void blocks_rshift(Block* r, const Block* a, int n, int count) {
+    if (count == 0) {
+        memmove(r, a, n * sizeof(Block));
+        return;
+    }
+
+    for (int i = 0; i < n - 1; i++) {
+        r[i] = (a[i] >> count) | (a[i + 1] << (BLOCK_SIZE - count));
+    }
+    r[n - 1] = a[n - 1] >> count;
+}
+
+/*
+ * Compute `r = a >> count` for `0 < count < BLOCK_SIZE`, where `a` and `r` have
+ * `n` blocks and are read as two's complement numbers, i.e. the sign bit is
+ * shifted in at the top. `r` may be the same array as `a`.
+ */
+static void twos_rshift(Block* r, const Block* a, int n, int count) {
+    Block sign = (a[n - 1] >> (BLOCK_SIZE - 1)) ? BLOCK_MASK << (BLOCK_SIZE - count) : 0;
+
+    for (int i = 0; i < n - 1; i++) {
+        r[i] = (a[i] >> count) | (a[i + 1] << (BLOCK_SIZE - count));
+    }
+    r[n - 1] = (a[n - 1] >> count) | sign;
+}
+
+/*
+ * Compute `r = a / 3` modulo 2^(n * BLOCK_SIZE), where `a` and `r` have `n` blocks
+ * and `a` is known to be a multiple of 3. Since this multiplies by the inverse of
+ * 3 rather than dividing, it also works for two's complement numbers. `r` may be
+ * the same array as `a`.
+ */
+static void blocks_divexact_by3(Block* r, const Block* a, int n) {
+    const Block inverse = BLOCK_MASK / 3 * 2 + 1; // 3 * inverse = 1 mod 2^BLOCK_SIZE
+    Block borrow = 0;
+
+    for (int i = 0; i < n; i++) {
+        Block next = a[i] < borrow;
+        Block q = (a[i] - borrow) * inverse;
+        r[i] = q;
+        borrow = (Block) (((DBlock) q * 3) >> BLOCK_SIZE) + next;
+    }
+}
+
+/*
+ * Compute the number of blocks of `a`, which has `n` blocks, that remain after
+ * dropping zero blocks from its most significant end.
+ */
+static int blocks_normalized_size(const Block* a, int n) {
+    while (n > 0 && a[n - 1] == 0) { n--; }
+
+    return n;
+}
+
+/*
+ * Count the leading zero bits of a nonzero block.
+ */
+static int block_clz(Block x) {
+#if BLOCK_SIZE == 64
+    return __builtin_clzll(x);
+#else
+    return __builtin_clz(x);
+#endif
+}
+
+/*
+ * Compute `r = a * b`, where `a` has `an` blocks and `b` has `1 <= bn <= an`
+ * blocks, choosing a multiplication algorithm based on the operand sizes. `r` must
+ * have room for `an + bn` blocks and must not overlap either input. If `a` and
+ * `b` are the same array, the product is computed as a square.
+ */
+static void blocks_mul(Block* r, const Block* a, int an, const Block* b, int bn) {
+    if (a == b && an == bn) {
+        blocks_sqr(r, a, an);
+        return;
+    }
+
+    if (bn < get_threshold(BNUM_KARATSUBA_THRESHOLD)) {
+        blocks_mul_basecase(r, a, an, b, bn);
+        return;
+    }
+
+    if (bn >= get_threshold(BNUM_NTT_THRESHOLD) && ntt_fits(an, bn)) {
+        ntt_mul(r, a, an, b, bn);
+        return;
+    }
+
+    // nearly balanced operands
+    if (8 * (int64_t) an < 9 * (int64_t) bn) {
+        if (bn >= get_threshold(BNUM_TOOM33_THRESHOLD) && toom_fits(an, bn, 3, 3)) {
+            toom_mul(r, a, an, b, bn, 3, 3);
+        }
+        else if (an == bn) {
+            int scratch_size = karatsuba_scratch_size(bn);
+            Block* scratch = temp_blocks(scratch_size);
+            karatsuba_mul(r, a, b, bn, scratch);
+            free_temp_blocks(scratch, scratch_size);
+        }
+        else {
+            blocks_mul_chunked(r, a, an, b, bn, bn);
+        }
+        return;
+    }
+
+    // unbalanced operands: pick the Toom variant whose split best matches the
+    // ratio of the sizes, or cut `a` into pieces the size of `b` if none fits
+    int parts_a = 0;
+    int parts_b = 0;
+    if (bn >= get_threshold(BNUM_TOOM32_THRESHOLD)) {
+        if (8 * (int64_t) an < 11 * (int64_t) bn) { parts_a = 4; parts_b = 3; }
+        else if (4 * (int64_t) an < 7 * (int64_t) bn) { parts_a = 3; parts_b = 2; }
+        else if (2 * (int64_t) an < 5 * (int64_t) bn) { parts_a = 4; parts_b = 2; }
+        else {
+            blocks_mul_chunked(r, a, an, b, bn, 2 * bn);
+            return;
+        }
+    }
+
+    if (parts_a && toom_fits(an, bn, parts_a, parts_b)) {
+        toom_mul(r, a, an, b, bn, parts_a, parts_b);
+    }
+    else {
+        blocks_mul_chunked(r, a, an, b, bn, bn);
+    }
+}
+
+/*
+ * Compute `r = a * a`, where `a` has `n >= 1` blocks, choosing a squaring
+ * algorithm based on its size. These mirror the multiplication algorithms, with
+ * their own thresholds since squaring in the basecase is cheaper. `r` must have
+ * room for `2 * n` blocks and must not overlap `a`.
+ */
+static void blocks_sqr(Block* r, const Block* a, int n) {
+    if (n < get_threshold(BNUM_SQR_KARATSUBA_THRESHOLD)) {
+        blocks_sqr_basecase(r, a, n);
+    }
+    else if (n >= get_threshold(BNUM_NTT_THRESHOLD) && ntt_fits(n, n)) {
+        ntt_mul(r, a, n, a, n);
+    }
+    else if (n >= get_threshold(BNUM_SQR_TOOM3_THRESHOLD) && toom_fits(n, n, 3, 3)) {
+        toom_mul(r, a, n, a, n, 3, 3);
+    }
+    else {
+        int scratch_size = karatsuba_scratch_size(n);
+        Block* scratch = temp_blocks(scratch_size);
+        karatsuba_mul(r, a, a, n, scratch);
+        free_temp_blocks(scratch, scratch_size);
+    }
+}
+
+/*
+ * Compute `r = a * b`, where `a` has `an` blocks and `b` has `1 <= bn <= an`
+ * blocks, by multiplying `b` by one `chunk` block piece of `a` at a time and
+ * adding the partial products together. `r` must have room for `an + bn` blocks
+ * and must not overlap either input.
+ */
+static void blocks_mul_chunked(Block* r, const Block* a, int an, const Block* b, int bn,
+        int chunk) {
+    Block* product = temp_blocks(chunk + bn);
+    memset(r, 0, (an + bn) * sizeof(Block));
+
+    for (int i = 0; i < an; i += chunk) {
+        int len = an - i < chunk ? an - i : chunk;
+        if (len >= bn) {
+            blocks_mul(product, a + i, len, b, bn);
+        }
+        else {
+            blocks_mul(product, b, bn, a + i, len);
+        }
+        blocks_add(r + i, r + i, an + bn - i, product, len + bn);
+    }
+
+    free_temp_blocks(product, chunk + bn);
+}
+
+/*
+ * Compute `r = a * b` with the schoolbook method, where `a` has `an` blocks and
+ * `b` has `1 <= bn <= an` blocks. `r` must have room for `an + bn` blocks and
+ * must not overlap either input.
+ */
+static void blocks_mul_basecase(Block* r, const Block* a, int an, const Block* b, int bn) {
+    r[an] = blocks_mul_1(r, a, an, b[0]);
+    for (int i = 1; i < bn; i++) {
+        r[an + i] = blocks_addmul_1(r + i, a, an, b[i]);
+    }
+}
+
+/*
+ * Compute `r = a * a` with the schoolbook method, where `a` has `n >= 1` blocks.
+ * Each cross product `a[i] * a[j]`, `i < j`, is computed once and doubled,
+ * before the squares `a[i] * a[i]` are added in. `r` must have room for `2 * n`
+ * blocks and must not overlap `a`.
+ */
+static void blocks_sqr_basecase(Block* r, const Block* a, int n) {
+    r[0] = 0;
+    r[2 * n - 1] = 0;
+    if (n > 1) {
+        r[n] = blocks_mul_1(r + 1, a + 1, n - 1, a[0]);
+        for (int i = 1; i < n - 1; i++) {
+            r[n + i] = blocks_addmul_1(r + 2 * i + 1, a + i + 1, n - i - 1, a[i]);
+        }
+        blocks_lshift(r, r, 2 * n, 1);
+    }
+
+    DBlock carry = 0;
+    for (int i = 0; i < n; i++) {
+        DBlock square = (DBlock) a[i] * a[i];
+        carry += (DBlock) r[2 * i] + (Block) square;
+        r[2 * i] = (Block) carry;
+        carry >>= BLOCK_SIZE;
+        carry += (DBlock) r[2 * i + 1] + (Block) (square >> BLOCK_SIZE);
+        r[2 * i + 1] = (Block) carry;
+        carry >>= BLOCK_SIZE;
+    }
+}
+
+/*
+ * Compute `r = a * b`, where `a` and `b` both have `n` blocks, using Karatsuba
+ * multiplication if `n` is large enough. If `a` and `b` are the same array, the
+ * product is computed as a square. `r` must have room for `2 * n` blocks and
+ * `scratch` for `karatsuba_scratch_size(n)` blocks.
+ */
+static void blocks_mul_n(Block* r, const Block* a, const Block* b, int n, Block* scratch) {
+    if (a == b && n < get_threshold(BNUM_SQR_KARATSUBA_THRESHOLD)) {
+        blocks_sqr_basecase(r, a, n);
+    }
+    else if (a != b && n < get_threshold(BNUM_KARATSUBA_THRESHOLD)) {
+        blocks_mul_basecase(r, a, n, b, n);
+    }
+    else {
+        karatsuba_mul(r, a, b, n, scratch);
+    }
+}
+
+/*
+ * Compute `r = a * b` with Karatsuba multiplication, where `a` and `b` both have
+ * `n >= 2` blocks. Writing `a = a1 * B + a0` and `b = b1 * B + b0`, where `B` is
+ * 2^(lo * BLOCK_SIZE) for half the length `lo`, the product is
+ *
+ *      a1 * b1 * B^2 + (a0 * b1 + a1 * b0) * B + a0 * b0
+ *
+ * and the middle term is recovered from the other two and a single extra product,
+ * as `a0 * b0 + a1 * b1 - (a0 - a1) * (b0 - b1)`. If `a` and `b` are the same
+ * array, all three products are squares.
+ *
+ * `r` must have room for `2 * n` blocks and `scratch` for
+ * `karatsuba_scratch_size(n)` blocks.
+ */
+static void karatsuba_mul(Block* r, const Block* a, const Block* b, int n, Block* scratch) {
+    int lo = n - n / 2;
+    int hi = n / 2;
+
+    Block* diff_a = scratch;
+    Block* diff_b = diff_a + lo;
+    Block* mid_product = diff_b + lo;
+    Block* middle = mid_product + 2 * lo;
+    Block* next_scratch = middle + 2 * lo + 1;
+
+    // |a0 - a1| and |b0 - b1|, remembering whether each difference is negative
+    int neg_a = lo == hi ? blocks_cmp(a, a + lo, lo) < 0 :
+        a[lo - 1] == 0 && blocks_cmp(a, a + lo, hi) < 0;
+    if (neg_a) { diff_a[lo - 1] = 0; blocks_sub(diff_a, a + lo, hi, a, hi); }
+    else { blocks_sub(diff_a, a, lo, a + lo, hi); }
+
+    int neg_b = neg_a;
+    if (a == b) {
+        diff_b = diff_a;
+    }
+    else {
+        neg_b = lo == hi ? blocks_cmp(b, b + lo, lo) < 0 :
+            b[lo - 1] == 0 && blocks_cmp(b, b + lo, hi) < 0;
+        if (neg_b) { diff_b[lo - 1] = 0; blocks_sub(diff_b, b + lo, hi, b, hi); }
+        else { blocks_sub(diff_b, b, lo, b + lo, hi); }
+    }
+
+    blocks_mul_n(r, a, b, lo, next_scratch);
+    blocks_mul_n(r + 2 * lo, a + lo, b + lo, hi, next_scratch);
+    blocks_mul_n(mid_product, diff_a, diff_b, lo, next_scratch);
+
+    // middle = a0 * b0 + a1 * b1 -/+ |a0 - a1| * |b0 - b1|
+    middle[2 * lo] = blocks_add(middle, r, 2 * lo, r + 2 * lo, 2 * hi);
+    if (neg_a == neg_b) {
+        blocks_sub(middle, middle, 2 * lo + 1, mid_product, 2 * lo);
+    }
+    else {
+        blocks_add(middle, middle, 2 * lo + 1, mid_product, 2 * lo);
+    }
+
+    // add it in at offset `lo`; the sum fits in `2 * n` blocks, so anything
+    // `middle` has beyond that is zero
+    int middle_len = 2 * lo + 1;
+    if (middle_len > 2 * n - lo) { middle_len = 2 * n - lo; }
+    blocks_add(r + lo, r + lo, 2 * n - lo, middle, middle_len);
+}
+
+/*
+ * Compute the number of blocks of scratch space `karatsuba_mul()` needs to
+ * multiply or square `n` block numbers, including the space for its recursive
+ * calls.
+ */
+static int karatsuba_scratch_size(int n) {
+    int threshold = get_threshold(BNUM_KARATSUBA_THRESHOLD);
+    if (get_threshold(BNUM_SQR_KARATSUBA_THRESHOLD) < threshold) {
+        threshold = get_threshold(BNUM_SQR_KARATSUBA_THRESHOLD);
+    }
+    if (n < threshold) { return 0; }
+
+    int lo = n - n / 2;
+    return 6 * lo + 1 + karatsuba_scratch_size(lo);
+}
+
+/*
+ * Determine whether `toom_mul()` can split an `an` block number into `parts_a`
+ * pieces and a `bn` block number into `parts_b` pieces, i.e. whether the most
+ * significant piece of each is nonempty.
+ */
+static int toom_fits(int an, int bn, int parts_a, int parts_b) {
+    int k = (an + parts_a - 1) / parts_a;
+    if ((bn + parts_b - 1) / parts_b > k) { k = (bn + parts_b - 1) / parts_b; }
+
+    return an > (parts_a - 1) * k && bn > (parts_b - 1) * k;
+}
+
+/*
+ * Compute `r = a * b` with Toom-Cook multiplication, where `a` has `an` blocks and
+ * `b` has `bn <= an` blocks. `a` is split into `parts_a` pieces and `b` into
+ * `parts_b` pieces of `k` blocks (except the most significant ones), which are
+ * read as the coefficients of polynomials `a(x)` and `b(x)` such that `a = a(B)`
+ * and `b = b(B)` for `B = 2^(k * BLOCK_SIZE)`. Their product has degree
+ * `d = parts_a + parts_b - 2`, so it is determined by its values at `d + 1`
+ * points; these are computed with much smaller recursive multiplications, then
+ * the coefficients of the product are interpolated and added up at `B`.
+ *
+ * Supported splits are 3x3 (Toom-3), 3x2 (Toom-2.5), 4x2 and 4x3 (Toom-3.5),
+ * using the points
+ *
+ *      d = 3:  0, 1, -1, inf
+ *      d = 4:  0, 1, -1, -2, inf
+ *      d = 5:  0, 1, -1, 2, -2, inf
+ *
+ * The interpolation works on `2 * k + 2` block two's complement values, since
+ * some intermediate values are negative. If `a` and `b` are the same array, `b`
+ * is not evaluated separately and all the recursive products are squares. `r`
+ * must have room for `an + bn` blocks and must not overlap either input;
+ * `toom_fits()` must hold for the split.
+ */
+static void toom_mul(Block* r, const Block* a, int an, const Block* b, int bn,
+        int parts_a, int parts_b) {
+    int k = (an + parts_a - 1) / parts_a;
+    if ((bn + parts_b - 1) / parts_b > k) { k = (bn + parts_b - 1) / parts_b; }
+    int top_a = an - (parts_a - 1) * k;
+    int top_b = bn - (parts_b - 1) * k;
+    int degree = parts_a + parts_b - 2;
+    int w = 2 * k + 2;
+    int n = an + bn;
+
+    Block* temp = temp_blocks(8 * (k + 1) + 5 * w);
+    Block* a_pos = temp;
+    Block* a_neg = a_pos + (k + 1);
+    Block* b_pos = a_neg + (k + 1);
+    Block* b_neg = b_pos + (k + 1);
+    Block* a_pos2 = b_neg + (k + 1);
+    Block* a_neg2 = a_pos2 + (k + 1);
+    Block* b_pos2 = a_neg2 + (k + 1);
+    Block* b_neg2 = b_pos2 + (k + 1);
+    Block* v1 = b_neg2 + (k + 1);
+    Block* vm1 = v1 + w;
+    Block* v2 = vm1 + w;
+    Block* vm2 = v2 + w;
+    Block* t = vm2 + w;
+
+    // evaluate at 1 and -1, and 2 and -2
+    int neg1 = toom_eval(a_pos, a_neg, a, parts_a, k, top_a, 0, t);
+    if (a == b) { b_pos = a_pos; b_neg = a_neg; }
+    else { neg1 ^= toom_eval(b_pos, b_neg, b, parts_b, k, top_b, 0, t); }
+    int neg2 = 0;
+    if (degree >= 4) {
+        neg2 = toom_eval(a_pos2, a_neg2, a, parts_a, k, top_a, 1, t);
+        if (a == b) { b_pos2 = a_pos2; b_neg2 = a_neg2; }
+        else { neg2 ^= toom_eval(b_pos2, b_neg2, b, parts_b, k, top_b, 1, t); }
+    }
+
+    // the products at the points are independent, so large ones run in parallel;
+    // r(0) and r(inf) go straight to their final place in the result
+    const Block* v0 = r;
+    const Block* vinf = r + degree * k;
+    int vinf_len = top_a + top_b;
+    const Block* top_long = a + (parts_a - 1) * k;
+    const Block* top_short = b + (parts_b - 1) * k;
+    if (top_a < top_b) {
+        top_long = b + (parts_b - 1) * k;
+        top_short = a + (parts_a - 1) * k;
+    }
+    MulTask products[] = {
+        { TASK_INIT(mul_task_run), r, a, k, b, k },
+        { TASK_INIT(mul_task_run), r + degree * k, top_long, top_a > top_b ? top_a : top_b,
+            top_short, top_a > top_b ? top_b : top_a },
+        { TASK_INIT(mul_task_run), v1, a_pos, k + 1, b_pos, k + 1 },
+        { TASK_INIT(mul_task_run), vm1, a_neg, k + 1, b_neg, k + 1 },
+        { TASK_INIT(mul_task_run), vm2, a_neg2, k + 1, b_neg2, k + 1 },
+        { TASK_INIT(mul_task_run), v2, a_pos2, k + 1, b_pos2, k + 1 },
+    };
+    Task* tasks[6];
+    int count = degree + 1;
+    for (int i = 0; i < count; i++) { tasks[i] = &products[i].task; }
+    run_tasks(tasks, count, use_threads(bn));
+
+    memset(r + 2 * k, 0, (degree - 2) * k * sizeof(Block));
+    if (neg1 && a != b) { blocks_neg(vm1, vm1, w); }
+    if (neg2 && a != b) { blocks_neg(vm2, vm2, w); }
+
+    // interpolate the remaining coefficients
+    Block* coeffs[4];
+    if (degree == 3) {
+        // r1 = (r(1) - r(-1)) / 2 - r3,  r2 = (r(1) + r(-1)) / 2 - r0
+        blocks_sub(t, v1, w, vm1, w);
+        twos_rshift(t, t, w, 1);
+        blocks_sub(t, t, w, vinf, vinf_len);
+        blocks_add(vm1, vm1, w, v1, w);
+        twos_rshift(vm1, vm1, w, 1);
+        blocks_sub(vm1, vm1, w, v0, 2 * k);
+        coeffs[0] = t;
+        coeffs[1] = vm1;
+    }
+    else if (degree == 4) {
+        // Bodrato's sequence for the points 0, 1, -1, -2, inf
+        blocks_sub(vm2, vm2, w, v1, w);         // r3 = (r(-2) - r(1)) / 3
+        blocks_divexact_by3(vm2, vm2, w);
+        blocks_sub(t, v1, w, vm1, w);           // r1 = (r(1) - r(-1)) / 2
+        twos_rshift(t, t, w, 1);
+        blocks_sub(vm1, vm1, w, v0, 2 * k);     // r2 = r(-1) - r(0)
+        blocks_sub(vm2, vm1, w, vm2, w);        // r3 = (r2 - r3) / 2 + 2 * r(inf)
+        twos_rshift(vm2, vm2, w, 1);
+        blocks_add(vm2, vm2, w, vinf, vinf_len);
+        blocks_add(vm2, vm2, w, vinf, vinf_len);
+        blocks_add(vm1, vm1, w, t, w);          // r2 = r2 + r1 - r(inf)
+        blocks_sub(vm1, vm1, w, vinf, vinf_len);
+        blocks_sub(t, t, w, vm2, w);            // r1 = r1 - r3
+        coeffs[0] = t;
+        coeffs[1] = vm1;
+        coeffs[2] = vm2;
+    }
+    else {
+        // split r(1), r(-1) and r(2), r(-2) into their even and odd parts:
+        //      (r(1) + r(-1)) / 2 = r0 + r2 + r4
+        //      (r(1) - r(-1)) / 2 = r1 + r3 + r5
+        //      (r(2) + r(-2)) / 2 = r0 + 4 * r2 + 16 * r4
+        //      (r(2) - r(-2)) / 4 = r1 + 4 * r3 + 16 * r5
+        blocks_sub(t, v1, w, vm1, w);
+        twos_rshift(t, t, w, 1);
+        blocks_add(v1, v1, w, vm1, w);
+        twos_rshift(v1, v1, w, 1);
+        blocks_sub(vm1, v2, w, vm2, w);
+        twos_rshift(vm1, vm1, w, 2);
+        blocks_add(v2, v2, w, vm2, w);
+        twos_rshift(v2, v2, w, 1);
+
+        // even coefficients: v1 = r2 + r4, v2 = r2 + 4 * r4
+        blocks_sub(v1, v1, w, v0, 2 * k);
+        blocks_sub(v2, v2, w, v0, 2 * k);
+        twos_rshift(v2, v2, w, 2);
+        blocks_sub(v2, v2, w, v1, w);           // r4 = (v2 - v1) / 3
+        blocks_divexact_by3(v2, v2, w);
+        blocks_sub(v1, v1, w, v2, w);           // r2 = v1 - r4
+
+        // odd coefficients: t = r1 + r3, vm1 = r1 + 4 * r3
+        blocks_sub(t, t, w, vinf, vinf_len);
+        vm2[vinf_len] = blocks_lshift(vm2, vinf, vinf_len, 4);
+        blocks_sub(vm1, vm1, w, vm2, vinf_len + 1);
+        blocks_sub(vm1, vm1, w, t, w);          // r3 = (vm1 - t) / 3
+        blocks_divexact_by3(vm1, vm1, w);
+        blocks_sub(t, t, w, vm1, w);            // r1 = t - r3
+        coeffs[0] = t;
+        coeffs[1] = v1;
+        coeffs[2] = vm1;
+        coeffs[3] = v2;
+    }
+
+    // the coefficients are all nonnegative and their sum fits in `r`, so any
+    // blocks that reach past the end of `r` are zero
+    for (int i = 1; i < degree; i++) {
+        int len = n - i * k < w ? n - i * k : w;
+        blocks_add(r + i * k, r + i * k, n - i * k, coeffs[i - 1], len);
+    }
+
+    free_temp_blocks(temp, 8 * (k + 1) + 5 * w);
+}
+
+/*
+ * Evaluate the polynomial with the `parts` pieces of `x` as its coefficients (see
+ * `toom_mul()`) at `2^shift` and `-2^shift`. The pieces are `k` blocks long,
+ * except the last one which has `top` blocks. The values are split into their
+ * even and odd parts `e` and `o`, so that `x(2^shift) = e + o` and
+ * `x(-2^shift) = e - o`.
+ *
+ * Parameters:  pos     Where to store x(2^shift), `k + 1` blocks.
+ *              neg     Where to store |x(-2^shift)|, `k + 1` blocks.
+ *              temp    Scratch space of `k + 1` blocks.
+ *
+ * Returns: 1 if x(-2^shift) is negative, 0 otherwise.
+ */
+static int toom_eval(Block* pos, Block* neg, const Block* x, int parts, int k, int top,
+        int shift, Block* temp) {
+    Block* even = pos;
+    Block* odd = temp;
+
+    // Horner's rule on the even and odd coefficients separately, in steps of x^2
+    for (int parity = 0; parity < 2; parity++) {
+        Block* acc = parity ? odd : even;
+        int i = (parts - 1) % 2 == parity ? parts - 1 : parts - 2;
+        int len = i == parts - 1 ? top : k;
+        memcpy(acc, x + i * k, len * sizeof(Block));
+        memset(acc + len, 0, (k + 1 - len) * sizeof(Block));
+
+        for (i -= 2; i >= 0; i -= 2) {
+            blocks_lshift(acc, acc, k + 1, 2 * shift);
+            blocks_add(acc, acc, k + 1, x + i * k, k);
+        }
+    }
+    blocks_lshift(odd, odd, k + 1, shift);
+
+    int negative = blocks_cmp(even, odd, k + 1) < 0;
+    if (negative) { blocks_sub(neg, odd, k + 1, even, k + 1); }
+    else { blocks_sub(neg, even, k + 1, odd, k + 1); }
+    blocks_add(pos, even, k + 1, odd, k + 1);
+
+    return negative;
+}
+
+
+/* ---------- Division ---------- */
+
+/*
+ * Compute `q = a / b` and `r = a % b`, where `a` has `an` blocks and `b` has
+ * `1 <= bn <= an` blocks with a nonzero most significant block. `q` must have
+ * room for `an - bn + 1` blocks and `r` for `bn` blocks; neither may overlap the
+ * inputs.
+ *
+ * Single-block divisors are handled by `blocks_divrem_1()`. Otherwise `b` is
+ * shifted so that its most significant bit is set, which all the other division
+ * functions require, and `a` is shifted along with it.
+ */
+static void blocks_divrem(Block* q, Block* r, const Block* a, int an, const Block* b, int bn) {
+    if (bn == 1) {
+        r[0] = blocks_divrem_1(q, a, an, b[0]);
+        return;
+    }
+
+    int shift = block_clz(b[bn - 1]);
+    Block* temp = temp_blocks(an + 1 + bn);
+    Block* u = temp;
+    Block* d = temp + an + 1;
+    blocks_lshift(d, b, bn, shift);
+    u[an] = blocks_lshift(u, a, an, shift);
+
+    // the extra top block is less than `d`'s, so the quotient fits in `q`
+    div_qr(q, u, an + 1, d, bn);
+
+    blocks_rshift(r, u, bn, shift);
+    free_temp_blocks(temp, an + 1 + bn);
+}
+
+/*
+ * Compute `q = a / divisor` and `r = a % divisor` like `blocks_divrem()`, using
+ * the precomputed data of the divisor. `a` has `an` blocks, at least as many as
+ * the divisor.
+ */
+static void divisor_divrem(Block* q, Block* r, const Block* a, int an,
+        const Bnum_divisor* divisor) {
+    int n = divisor->num_blocks;
+    if (n == 1) {
+        r[0] = blocks_divrem_1_pre(q, a, an, divisor->d[0], divisor->shift, divisor->inverse);
+        return;
+    }
+
+    Block* u = temp_blocks(an + 1);
+    u[an] = blocks_lshift(u, a, an, divisor->shift);
+    if (divisor->x) { reciprocal_div_qr(q, u, an + 1, divisor->d, n, divisor->x); }
+    else { div_qr_pi(q, u, an + 1, divisor->d, n, divisor->inverse); }
+
+    blocks_rshift(r, u, n, divisor->shift);
+    free_temp_blocks(u, an + 1);
+}
+
+/*
+ * Divide `u`, which has `un` blocks, by `d`, which has `2 <= dn <= un` blocks and
+ * its most significant bit set, choosing a division algorithm based on the sizes.
+ * The low `un - dn` blocks of the quotient are stored in `q`, and the remainder
+ * replaces the low `dn` blocks of `u`; the rest of `u` is clobbered.
+ *
+ * Returns: The most significant block of the quotient (0 or 1).
+ */
+static Block div_qr(Block* q, Block* u, int un, const Block* d, int dn) {
+    int qn = un - dn;
+    // computing the reciprocal costs a few multiplications, which only pays off
+    // when it is used for several chunks of the quotient
+    if (dn >= get_threshold(BNUM_NEWTON_DIV_THRESHOLD) && qn >= 4 * dn) {
+        return newton_div_qr(q, u, un, d, dn);
+    }
+
+    return div_qr_pi(q, u, un, d, dn, invert_3by2(d[dn - 1], d[dn - 2]));
+}
+
+/*
+ * Schoolbook or divide-and-conquer division, with the same interface as `div_qr()`
+ * and `inverse` from `invert_3by2()` for the top two blocks of `d`.
+ */
+static Block div_qr_pi(Block* q, Block* u, int un, const Block* d, int dn, Block inverse) {
+    int qn = un - dn;
+    if (dn < get_threshold(BNUM_DC_DIV_THRESHOLD) || qn < get_threshold(BNUM_DC_DIV_THRESHOLD)) {
+        return sb_div_qr(q, u, un, d, dn, inverse);
+    }
+
+    Block* temp = temp_blocks(dn);
+    Block qh = dc_div_qr(q, u, un, d, dn, inverse, temp);
+    free_temp_blocks(temp, dn);
+
+    return qh;
+}
+
+/*
+ * Schoolbook division, with the same interface as `div_qr()` and `inverse` from
+ * `invert_3by2()` for the top two blocks of `d`.
+ *
+ * This is Knuth's Algorithm D: each quotient block is estimated from the top three
+ * blocks of the remainder and the top two of `d` with a precomputed reciprocal,
+ * which is at most one too large.
+ */
+static Block sb_div_qr(Block* q, Block* u, int un, const Block* d, int dn, Block inverse) {
+    Block qh = blocks_cmp(u + un - dn, d, dn) >= 0;
+    if (qh) { blocks_sub(u + un - dn, u + un - dn, dn, d, dn); }
+
+    // the top `dn` blocks of `u` are now always less than `d`, which makes each
+    // quotient block fit in a single block
+    Block d1 = d[dn - 1];
+    Block d0 = d[dn - 2];
+    for (int j = un - dn - 1; j >= 0; j--) {
+        Block u2 = u[j + dn];
+        Block u1 = u[j + dn - 1];
+        Block u0 = u[j + dn - 2];
+        Block qhat = u2 == d1 && u1 == d0 ? BLOCK_MASK : div_3by2(u2, u1, u0, d1, d0, inverse);
+
+        Block borrow = blocks_submul_1(u + j, d, dn, qhat);
+        if (u2 < borrow) {
+            blocks_add(u + j, u + j, dn, d, dn);
+            qhat--;
+        }
+        u[j + dn] = 0;
+        q[j] = qhat;
+    }
+
+    return qh;
+}
+
+/*
+ * Divide-and-conquer division (Burnikel-Ziegler), with the same interface as
+ * `sb_div_qr()` and `dn` blocks of scratch space in `temp`.
+ *
+ * The quotient is computed `dn` blocks at a time with `dc_div_qr_n()`, starting
+ * with the `(un - dn) % dn` most significant blocks (if any), which only need the
+ * top blocks of `d`.
+ */
+static Block dc_div_qr(Block* q, Block* u, int un, const Block* d, int dn, Block inverse,
+        Block* temp) {
+    int qn = un - dn;
+    int k = (qn - 1) % dn + 1;
+    Block* uk = u + qn - k;
+    Block* qk = q + qn - k;
+    Block qh;
+
+    if (k < get_threshold(BNUM_DC_DIV_THRESHOLD)) {
+        qh = sb_div_qr(qk, uk, dn + k, d, dn, inverse);
+    }
+    else {
+        // divide by the top `k` blocks of `d`, then take the rest of it into account
+        qh = dc_div_qr_n(qk, uk + dn - k, d + dn - k, k, inverse, temp);
+        if (k < dn) {
+            if (k >= dn - k) { blocks_mul(temp, qk, k, d, dn - k); }
+            else { blocks_mul(temp, d, dn - k, qk, k); }
+
+            Block borrow = blocks_sub(uk, uk, dn, temp, dn);
+            if (qh) { borrow += blocks_sub(uk + k, uk + k, dn - k, d, dn - k); }
+            while (borrow) {
+                qh -= blocks_sub_1(qk, qk, k, 1);
+                borrow -= blocks_add(uk, uk, dn, d, dn);
+            }
+        }
+    }
+
+    for (int j = qn - k - dn; j >= 0; j -= dn) {
+        dc_div_qr_n(q + j, u + j, d, dn, inverse, temp);
+    }
+
+    return qh;
+}
+
+/*
+ * Divide `u`, which has `2n` blocks, by `d`, which has `n` blocks and its most
+ * significant bit set, recursively. The quotient has `n` blocks plus the returned
+ * most significant block (0 or 1), and the remainder replaces the low `n` blocks
+ * of `u`. `temp` must have room for `n` blocks.
+ *
+ * Each half of the quotient is found by dividing by the high half of `d` only
+ * and then subtracting the product with the low half, which is at most a couple
+ * of multiples of `d` off.
+ */
+static Block dc_div_qr_n(Block* q, Block* u, const Block* d, int n, Block inverse, Block* temp) {
+    int lo = n / 2;
+    int hi = n - lo;
+
+    // high half of the quotient
+    Block qh = hi < get_threshold(BNUM_DC_DIV_THRESHOLD)
+        ? sb_div_qr(q + lo, u + 2 * lo, 2 * hi, d + lo, hi, inverse)
+        : dc_div_qr_n(q + lo, u + 2 * lo, d + lo, hi, inverse, temp);
+
+    blocks_mul(temp, q + lo, hi, d, lo);
+    Block borrow = blocks_sub(u + lo, u + lo, n, temp, n);
+    if (qh) { borrow += blocks_sub(u + n, u + n, lo, d, lo); }
+    while (borrow) {
+        qh -= blocks_sub_1(q + lo, q + lo, hi, 1);
+        borrow -= blocks_add(u + lo, u + lo, n, d, n);
+    }
+
+    // low half of the quotient
+    Block ql = lo < get_threshold(BNUM_DC_DIV_THRESHOLD)
+        ? sb_div_qr(q, u + hi, 2 * lo, d + hi, lo, inverse)
+        : dc_div_qr_n(q, u + hi, d + hi, lo, inverse, temp);
+
+    blocks_mul(temp, d, hi, q, lo);
+    borrow = blocks_sub(u, u, n, temp, n);
+    if (ql) { borrow += blocks_sub(u + lo, u + lo, hi, d, hi); }
+    while (borrow) {
+        blocks_sub_1(q, q, lo, 1);
+        borrow -= blocks_add(u, u, n, d, n);
+    }
+
+    return qh;
+}
+
+/*
+ * Division by multiplication with a Newton-iterated reciprocal of `d`, with the
+ * same interface as `div_qr()`.
+ *
+ * With `x = floor((B^(2 dn) - 1) / d)`, where `B = 2^BLOCK_SIZE`, the quotient of
+ * a chunk of `dn + k` blocks whose top `dn` blocks are less than `d` is at most a
+ * few more than its top `k` blocks times `x`, shifted down by `dn` blocks. So each
+ * chunk of up to `dn` quotient blocks costs two multiplications and a short
+ * correction loop.
+ */
+static Block newton_div_qr(Block* q, Block* u, int un, const Block* d, int dn) {
+    Block* x = temp_blocks(dn + 1);
+    blocks_invert(x, d, dn);
+    Block qh = reciprocal_div_qr(q, u, un, d, dn, x);
+    free_temp_blocks(x, dn + 1);
+
+    return qh;
+}
+
+/*
+ * Division by multiplication with the reciprocal `x` of `d` from `blocks_invert()`,
+ * with the same interface as `div_qr()` otherwise.
+ */
+static Block reciprocal_div_qr(Block* q, Block* u, int un, const Block* d, int dn,
+        const Block* x) {
+    int qn = un - dn;
+    Block* product = temp_blocks(2 * dn + 1);
+
+    Block qh = blocks_cmp(u + qn, d, dn) >= 0;
+    if (qh) { blocks_sub(u + qn, u + qn, dn, d, dn); }
+
+    // the most significant chunk takes whatever is left over from whole chunks
+    for (int k = (qn - 1) % dn + 1, j = qn - k; j >= 0; k = dn, j -= dn) {
+        Block* w = u + j;
+
+        blocks_mul(product, x, dn + 1, w + dn, k);
+        memcpy(q + j, product + dn, k * sizeof(Block));
+
+        // the estimate is never too large, so this can't borrow
+        blocks_mul(product, d, dn, q + j, k);
+        blocks_sub(w, w, dn + k, product, dn + k);
+        while (w[dn] != 0 || blocks_cmp(w, d, dn) >= 0) {
+            w[dn] -= blocks_sub(w, w, dn, d, dn);
+            blocks_add_1(q + j, q + j, k, 1);
+        }
+    }
+
+    free_temp_blocks(product, 2 * dn + 1);
+
+    return qh;
+}
+
+/*
+ * Compute the reciprocal `x = floor((B^(2n) - 1) / d)` of `d`, which has `n >= 2`
+ * blocks and its most significant bit set, where `B = 2^BLOCK_SIZE`. `x` must have
+ * room for `n + 1` blocks; its most significant block is always 1.
+ *
+ * Small reciprocals are computed by division. Larger ones take the reciprocal
+ * `xh` of the top `h = ceil(n / 2)` blocks of `d`, which is good to about `h`
+ * blocks, and apply one Newton step, `x = xh + xh (B^(n + h) - d xh) / B^(2h)`
+ * (with `xh` scaled up to `n + 1` blocks), which roughly doubles the number of
+ * correct blocks. The last few units are then corrected exactly, using the error
+ * term of the Newton step to find `B^(2n) - d x` cheaply.
+ */
+static void blocks_invert(Block* x, const Block* d, int n) {
+    if (n < get_threshold(BNUM_NEWTON_DIV_THRESHOLD) || n < 4) {
+        Block* u = temp_blocks(2 * n);
+        for (int i = 0; i < 2 * n; i++) { u[i] = BLOCK_MASK; }
+        x[n] = div_qr(x, u, 2 * n, d, n);
+        free_temp_blocks(u, 2 * n);
+        return;
+    }
+
+    int h = (n + 1) / 2;
+    int temp_size = (h + 1) + (n + h + 1) + (n + 2 * h + 2) + (n + 2) + (n + 2) + 2 * n;
+    Block* temp = temp_blocks(temp_size);
+    Block* xh = temp;
+    Block* e = xh + h + 1;
+    Block* correction = e + n + h + 1;
+    Block* x1 = correction + n + 2 * h + 2;
+    Block* rho = x1 + n + 2;
+    Block* p = rho + n + 2;
+
+    blocks_invert(xh, d + n - h, h);
+
+    // e = B^(n + h) - d xh, which is less than 3 B^n in magnitude
+    blocks_mul(e, d, n, xh, h + 1);
+    int negative = e[n + h] != 0;
+    if (negative) { e[n + h]--; }
+    else { blocks_neg(e, e, n + h); }
+    int en = blocks_normalized_size(e, n + h + 1);
+
+    // x1 = xh B^(n - h) +- floor(xh |e| / B^(2h))
+    memset(x1, 0, (n - h) * sizeof(Block));
+    memcpy(x1 + n - h, xh, (h + 1) * sizeof(Block));
+    x1[n + 1] = 0;
+    int cn = 0;
+    if (en > 0) {
+        if (en >= h + 1) { blocks_mul(correction, e, en, xh, h + 1); }
+        else { blocks_mul(correction, xh, h + 1, e, en); }
+        cn = blocks_normalized_size(correction, en + h + 1) - 2 * h;
+        if (cn > 0) {
+            if (negative) { blocks_sub(x1, x1, n + 2, correction + 2 * h, cn); }
+            else { blocks_add(x1, x1, n + 2, correction + 2 * h, cn); }
+        }
+    }
+
+    // rho = B^(2n) - d x1 = e B^(n - h) - d (x1 - xh B^(n - h)), with the signs of
+    // e and the correction flipped if e is negative. It is only a few times `d`
+    // in magnitude, so it can be computed modulo B^(n + 2) as a signed number
+    // without ever multiplying `d` by all of `x1`.
+    memset(rho, 0, (n + 2) * sizeof(Block));
+    memcpy(rho + n - h, e, (en < h + 2 ? en : h + 2) * sizeof(Block));
+    if (cn > 0) {
+        blocks_mul(p, d, n, correction + 2 * h, cn);
+        blocks_sub(rho, rho, n + 2, p, n + cn < n + 2 ? n + cn : n + 2);
+    }
+    if (negative) { blocks_neg(rho, rho, n + 2); }
+
+    // make x1 exact: d x1 <= B^(2n) - 1 < d (x1 + 1), i.e. 1 <= rho <= d
+    while ((rho[n + 1] >> (BLOCK_SIZE - 1)) || blocks_normalized_size(rho, n + 2) == 0) {
+        blocks_sub_1(x1, x1, n + 2, 1);
+        blocks_add(rho, rho, n + 2, d, n);
+    }
+    while (rho[n] != 0 || rho[n + 1] != 0 || blocks_cmp(rho, d, n) > 0) {
+        blocks_add_1(x1, x1, n + 2, 1);
+        blocks_sub(rho, rho, n + 2, d, n);
+    }
+
+    memcpy(x, x1, (n + 1) * sizeof(Block));
+    free_temp_blocks(temp, temp_size);
+}
+
+/*
+ * Compute `q = a / d`, where `a` and `q` have `n` blocks and `d` is a nonzero
+ * block. `q` may be the same array as `a`. Each step divides by a precomputed
+ * reciprocal of `d` instead of dividing in hardware.
+ *
+ * Returns: The remainder `a % d`.
+ */
+static Block blocks_divrem_1(Block* q, const Block* a, int n, Block d) {
+    int shift = block_clz(d);
+
+    return blocks_divrem_1_pre(q, a, n, d << shift, shift, invert_limb(d << shift));
+}
+
+/*
+ * Compute `q = a / (d >> shift)` like `blocks_divrem_1()`, given the divisor
+ * already shifted so that its most significant bit is set, along with its
+ * reciprocal from `invert_limb()`.
+ *
+ * Returns: The remainder.
+ */
+static Block blocks_divrem_1_pre(Block* q, const Block* a, int n, Block d, int shift,
+        Block inverse) {
+    // divide `a << shift` by `d << shift`, shifting each block in as it's needed
+    Block rem = shift ? a[n - 1] >> (BLOCK_SIZE - shift) : 0;
+    for (int i = n - 1; i >= 0; i--) {
+        Block next = a[i] << shift;
+        if (shift && i > 0) { next |= a[i - 1] >> (BLOCK_SIZE - shift); }
+        q[i] = div_2by1(&rem, rem, next, d, inverse);
+    }
+
+    return rem >> shift;
+}
+
+/*
+ * Compute the reciprocal `floor((B^2 - 1) / d) - B` of a block `d` that has its
+ * most significant bit set, where `B = 2^BLOCK_SIZE`.
+ */
+static Block invert_limb(Block d) {
+    return (Block) ((((DBlock) ~d << BLOCK_SIZE) | BLOCK_MASK) / d);
+}
+
+/*
+ * Compute the reciprocal `floor((B^3 - 1) / (d1 * B + d0)) - B` of a two-block
+ * number whose most significant bit is set, starting from the reciprocal of `d1`
+ * and correcting it for `d0`.
+ */
+static Block invert_3by2(Block d1, Block d0) {
+    Block v = invert_limb(d1);
+
+    Block p = d1 * v + d0;
+    if (p < d0) {
+        v--;
+        if (p >= d1) {
+            v--;
+            p -= d1;
+        }
+        p -= d1;
+    }
+
+    DBlock t = (DBlock) d0 * v;
+    Block t1 = (Block) (t >> BLOCK_SIZE);
+    Block t0 = (Block) t;
+    p += t1;
+    if (p < t1) {
+        v--;
+        if (p > d1 || (p == d1 && t0 >= d0)) { v--; }
+    }
+
+    return v;
+}
+
+/*
+ * Divide the two-block number `u1 * B + u0` by a block `d` that has its most
+ * significant bit set, using the reciprocal `v` from `invert_limb()`. Requires
+ * `u1 < d`.
+ *
+ * Parameters:  r   Where to store the remainder.
+ *
+ * Returns: The quotient.
+ */
+static Block div_2by1(Block* r, Block u1, Block u0, Block d, Block v) {
+    DBlock q = (DBlock) v * u1 + (((DBlock) u1 << BLOCK_SIZE) | u0);
+    Block q1 = (Block) (q >> BLOCK_SIZE) + 1;
+    Block q0 = (Block) q;
+
+    Block rem = u0 - q1 * d;
+    if (rem > q0) {
+        q1--;
+        rem += d;
+    }
+    if (rem >= d) {
+        q1++;
+        rem -= d;
+    }
+
+    *r = rem;
+    return q1;
+}
+
+/*
+ * Estimate the quotient of the three-block number `u2 * B^2 + u1 * B + u0` by
+ * the two-block `d1 * B + d0`, whose most significant bit is set, using the
+ * reciprocal `v` from `invert_3by2()`. Requires `u2 * B + u1 < d1 * B + d0`.
+ *
+ * Returns: The quotient, which as an estimate for a longer division is never too
+ *          small and at most one too large.
+ */
+static Block div_3by2(Block u2, Block u1, Block u0, Block d1, Block d0, Block v) {
+    DBlock d = ((DBlock) d1 << BLOCK_SIZE) | d0;
+    DBlock q = (DBlock) v * u2 + (((DBlock) u2 << BLOCK_SIZE) | u1);
+    Block q1 = (Block) (q >> BLOCK_SIZE);
+    Block q0 = (Block) q;
+
+    // candidate remainder (u1 - q1 * d1, u0) - d - q1 * d0, modulo B^2
+    Block r1 = u1 - q1 * d1;
+    DBlock rem = (((DBlock) r1 << BLOCK_SIZE) | u0) - d - (DBlock) d0 * q1;
+    q1++;
+
+    // q1 is now either exact, one too large or one too small
+    if ((Block) (rem >> BLOCK_SIZE) >= q0) {
+        q1--;
+        rem += d;
+    }
+    if (rem >= d) { q1++; }
+
+    return q1;
+}
+
+
+/* ---------- Montgomery Arithmetic ---------- */
+
+/*
+ * Compute `-1 / m0 mod B` for odd `m0`, where B is the block base.
+ */
+static Block mont_inverse(Block m0) {
+    // m0 is its own inverse mod 8, and each Newton step doubles the correct bits
+    Block inverse = m0;
+    for (int bits = 3; bits < BLOCK_SIZE; bits *= 2) { inverse *= 2 - m0 * inverse; }
+
+    return -inverse;
+}
+
+/*
+ * Montgomery multiplication: compute `r = a * b / R mod m` for the modulus `m` and
+ * `R = B^n` of `ctx`, where `a` and `b` are less than `m` and all have `n` blocks.
+ * `r` may be the same array as `a` or `b`, and `temp` must hold `2n` blocks.
+ *
+ * The product is formed in full and then reduced, rather than interleaving the
+ * two a block at a time, so that it can use `blocks_sqr()` and the subquadratic
+ * algorithms of `blocks_mul()`.
+ */
+static void blocks_mont_mul(Block* r, const Block* a, const Block* b,
+        const Bnum_mont_ctx* ctx, Block* temp) {
+    int n = ctx->num_blocks;
+    if (a == b) { blocks_sqr(temp, a, n); }
+    else { blocks_mul(temp, a, n, b, n); }
+
+    blocks_redc(r, temp, ctx);
+}
+
+/*
+ * Montgomery reduction: compute `r = t / R mod m` for the modulus `m` and `R = B^n`
+ * of `ctx`, where `t` has `2n` blocks and is less than `m * R`. `t` is overwritten.
+ */
+static void blocks_redc(Block* r, Block* t, const Bnum_mont_ctx* ctx) {
+    int n = ctx->num_blocks;
+    const Block* m = ctx->m;
+
+    // each step zeroes the lowest block left in `t`, and that block then holds the
+    // step's carry out of block `i + n` until they are all added in at the end.
+    // Steps are taken two at a time, in one pass over `t` with a carry for each.
+    int i = 0;
+    for (; i + 1 < n; i += 2) {
+        Block* w = t + i;
+        Block u0 = w[0] * ctx->minv;
+        DBlock carry0 = ((DBlock) m[0] * u0 + w[0]) >> BLOCK_SIZE;
+        carry0 += (DBlock) m[1] * u0 + w[1];
+        w[1] = (Block) carry0;
+        carry0 >>= BLOCK_SIZE;
+
+        Block u1 = w[1] * ctx->minv;
+        DBlock carry1 = ((DBlock) m[0] * u1 + w[1]) >> BLOCK_SIZE;
+        for (int k = 2; k < n; k++) {
+            carry0 += (DBlock) m[k] * u0 + w[k];
+            carry1 += (DBlock) m[k - 1] * u1 + (Block) carry0;
+            carry0 >>= BLOCK_SIZE;
+            w[k] = (Block) carry1;
+            carry1 >>= BLOCK_SIZE;
+        }
+        carry1 += (DBlock) m[n - 1] * u1 + w[n];
+        w[n] = (Block) carry1;
+
+        w[0] = (Block) carry0;
+        w[1] = (Block) (carry1 >> BLOCK_SIZE);
+    }
+    if (i < n) { t[i] = blocks_addmul_1(t + i, m, n, t[i] * ctx->minv); }
+    Block carry = blocks_add(t + n, t + n, n, t, n);
+
+    // the result is less than 2m
+    if (carry || blocks_cmp(t + n, m, n) >= 0) { blocks_sub(r, t + n, n, m, n); }
+    else { memcpy(r, t + n, n * sizeof(Block)); }
+}
+
+/*
+ * Store `a mod m` in `x`, padded with zeros to the `n` blocks of `m`.
+ */
+static void load_residue(Block* x, Bnum* a, const Block* m, int n) {
+    int an = a->num_blocks;
+    if (an > n || (an == n && blocks_cmp(a->blocks, m, n) >= 0)) {
+        Block* q = temp_blocks(an - n + 1);
+        blocks_divrem(q, x, a->blocks, an, m, n);
+        free_temp_blocks(q, an - n + 1);
+        return;
+    }
+
+    memcpy(x, a->blocks, an * sizeof(Block));
+    memset(x + an, 0, (n - an) * sizeof(Block));
+}
+
+/*
+ * Compute `r = a * b mod m`, with `blocks_mont_mul()` if `ctx` isn't NULL and
+ * otherwise by dividing by `divisor`. `a`, `b` and `r` have the `n` blocks of `m`,
+ * and `r` may be the same array as `a` or `b`. `temp` must hold `3n + 1` blocks.
+ */
+static void blocks_mulmod(Block* r, const Block* a, const Block* b, int n,
+        const Bnum_mont_ctx* ctx, const Bnum_divisor* divisor, Block* temp) {
+    if (ctx) {
+        blocks_mont_mul(r, a, b, ctx, temp);
+        return;
+    }
+
+    if (a == b) { blocks_sqr(temp, a, n); }
+    else { blocks_mul(temp, a, n, b, n); }
+    divisor_divrem(temp + 2 * n, r, temp, 2 * n, divisor);
+}
+
+/*
+ * Compute `r = a^e mod m`, where `a` and `r` have the `n` blocks of `m`, and `e`
+ * has `en` blocks with the top one nonzero. Products are reduced as in
+ * `blocks_mulmod()`; with a Montgomery context, `a` and `r` are in Montgomery form.
+ */
+static void blocks_powmod(Block* r, const Block* a, const Block* e, int en, int n,
+        const Bnum_mont_ctx* ctx, const Bnum_divisor* divisor) {
+    int64_t exp_bits = (int64_t) en * BLOCK_SIZE - block_clz(e[en - 1]);
+    int window = exp_bits > 671 ? 6 : exp_bits > 239 ? 5 : exp_bits > 79 ? 4
+            : exp_bits > 23 ? 3 : exp_bits > 7 ? 2 : 1;
+
+    // odd powers a, a^3, ..., a^(2^window - 1), made with `r` holding a^2
+    int num_powers = 1 << (window - 1);
+    int temp_size = num_powers * n + (3 * n + 1);
+    Block* powers = temp_blocks(temp_size);
+    Block* scratch = powers + num_powers * n;
+    memcpy(powers, a, n * sizeof(Block));
+    if (window > 1) {
+        blocks_mulmod(r, a, a, n, ctx, divisor, scratch);
+        for (int i = 1; i < num_powers; i++) {
+            blocks_mulmod(powers + i * n, powers + (i - 1) * n, r, n, ctx, divisor, scratch);
+        }
+    }
+
+    for (int64_t i = exp_bits - 1; i >= 0;) {
+        if (!((e[i / BLOCK_SIZE] >> (i % BLOCK_SIZE)) & 1)) {
+            blocks_mulmod(r, r, r, n, ctx, divisor, scratch);
+            i--;
+            continue;
+        }
+
+        // the longest window of at most `window` bits starting at bit `i` and
+        // ending in a 1 bit
+        int64_t low = i - window + 1 < 0 ? 0 : i - window + 1;
+        while (!((e[low / BLOCK_SIZE] >> (low % BLOCK_SIZE)) & 1)) { low++; }
+        int value = 0;
+        for (int64_t j = i; j >= low; j--) {
+            value = (value << 1) | ((e[j / BLOCK_SIZE] >> (j % BLOCK_SIZE)) & 1);
+        }
+        const Block* power = powers + (value >> 1) * n;
+
+        // the top bit of `e` always starts the first window
+        if (i == exp_bits - 1) { memcpy(r, power, n * sizeof(Block)); }
+        else {
+            for (int64_t j = i; j >= low; j--) { blocks_mulmod(r, r, r, n, ctx, divisor, scratch); }
+            blocks_mulmod(r, r, power, n, ctx, divisor, scratch);
+        }
+        i = low - 1;
+    }
+
+    free_temp_blocks(powers, temp_size);
+}
+
+
+/* ---------- Radix Conversion ---------- */
+
+/*
+ * Get the calling thread's tower of powers of `base`, with enough levels to split
+ * numbers of `num_blocks` blocks in `blocks_to_str()`, (re)building it as needed.
+ * Only the last base used is cached.
+ */
+static PowerTower* power_tower(int base, int num_blocks) {
+    PowerTower* tower = pool.tower;
+    if (tower && tower->base != base) {
+        tower_free(tower);
+        tower = NULL;
+    }
+    if (!tower) {
+        tower = mem_alloc(sizeof(PowerTower));
+        tower->base = base;
+        tower->num_levels = 0;
+
+        // the largest power of the base that fits in a block
+        int chunk_digits = digits_per_block(base);
+        Block chunk = base;
+        for (int i = 1; i < chunk_digits; i++) { chunk *= base; }
+        tower->chunk_digits = chunk_digits;
+        tower->chunk_shift = block_clz(chunk);
+        tower->chunk = chunk << tower->chunk_shift;
+        tower->chunk_inverse = invert_limb(tower->chunk);
+        pool.tower = tower;
+    }
+
+    // level i is chunk^(2^i), each the square of the one before, up to the first
+    // that is too large to split a number of `num_blocks` blocks
+    while (tower->num_levels == 0
+            || 2 * tower->powers[tower->num_levels - 1].num_blocks - 1 <= num_blocks) {
+        int i = tower->num_levels;
+        StrPower* power = &tower->powers[i];
+        if (i == 0) {
+            power->num_blocks = 1;
+            power->blocks = mem_alloc(sizeof(Block));
+            power->blocks[0] = tower->chunk >> tower->chunk_shift;
+            power->digits = tower->chunk_digits;
+        }
+        else {
+            StrPower* prev = &tower->powers[i - 1];
+            power->blocks = mem_alloc(2 * prev->num_blocks * sizeof(Block));
+            blocks_sqr(power->blocks, prev->blocks, prev->num_blocks);
+            power->num_blocks = blocks_normalized_size(power->blocks, 2 * prev->num_blocks);
+            power->digits = 2 * prev->digits;
+        }
+        tower->num_levels = i + 1;
+    }
+
+    return tower;
+}
+
+/*
+ * Free a tower of powers from `power_tower()`.
+ */
+static void tower_free(PowerTower* tower) {
+    for (int i = 0; i < tower->num_levels; i++) {
+        // squares are allocated at twice the size of the previous level
+        int capacity = i == 0 ? 1 : 2 * tower->powers[i - 1].num_blocks;
+        mem_free(tower->powers[i].blocks, capacity * sizeof(Block));
+    }
+    mem_free(tower, sizeof(PowerTower));
+}
+
+/*
+ * Write the digits of `x` in base `base` to `out`, for `Bnum_to_str()` and the
+ * functions that print numbers.
+ */
+static void write_digits(StrSink* out, Bnum* x, int base) {
+    int n = x->num_blocks;
+    if (n == 0) {
+        sink_put(out, "0", 1);
+        return;
+    }
+
+    if (!(base & (base - 1))) {
+        // slices of a multiple of `bits` blocks start on a digit boundary, so each
+        // is converted on its own, all but the top one with leading zeros
+        int bits = block_clz(1) - block_clz(base);
+        int slice = 16 * bits;
+        size_t slice_digits = (size_t) slice * BLOCK_SIZE / bits;
+        int low = (n - 1) / slice * slice;
+        char* p = sink_reserve(out, slice_digits);
+        out->len += to_str_pow2(p, x->blocks + low, n - low, 0, bits);
+        while (low > 0) {
+            low -= slice;
+            p = sink_reserve(out, slice_digits);
+            int sn = blocks_normalized_size(x->blocks + low, slice);
+            out->len += to_str_pow2(p, x->blocks + low, sn, slice_digits, bits);
+        }
+        return;
+    }
+
+    const PowerTower* tower = power_tower(base, n);
+
+    Block* temp = temp_blocks(n);
+    memcpy(temp, x->blocks, n * sizeof(Block));
+    blocks_to_str(out, temp, n, 0, tower);
+    free_temp_blocks(temp, n);
+}
+
+/*
+ * Write the digits of `x`, which has `xn` blocks, to `out`, in the base of
+ * `tower`. If `len` is nonzero exactly `len` digits are written, with leading
+ * zeros, and `x` must be less than `base^len`; otherwise only the significant
+ * digits are, which for zero is none. `x` is overwritten.
+ *
+ * The number is split in two by dividing by the largest power in the tower that
+ * is at most about its square root, and the quotient and remainder are converted
+ * recursively, the remainder with the padding to the power's number of digits.
+ * With subquadratic division this makes the conversion subquadratic too.
+ *
+ * Returns: The number of digits written.
+ */
+static size_t blocks_to_str(StrSink* out, Block* x, int xn, size_t len,
+        const PowerTower* tower) {
+    xn = blocks_normalized_size(x, xn);
+    int level = tower->num_levels - 1;
+    while (level >= 0 && 2 * tower->powers[level].num_blocks - 1 > xn) { level--; }
+    if (xn < get_threshold(BNUM_TO_STR_THRESHOLD) || level < 0) {
+        return to_str_basecase(out, x, xn, len, tower);
+    }
+
+    const StrPower* power = &tower->powers[level];
+    int pn = power->num_blocks;
+    int qn = xn - pn + 1;
+    Block* temp = temp_blocks(qn + pn);
+    Block* q = temp;
+    Block* r = q + qn;
+    blocks_divrem(q, r, x, xn, power->blocks, pn);
+
+    size_t high = len ? len - power->digits : 0;
+    high = blocks_to_str(out, q, qn, high, tower);
+    blocks_to_str(out, r, pn, power->digits, tower);
+    free_temp_blocks(temp, qn + pn);
+
+    return high + power->digits;
+}
+
+/*
+ * Schoolbook conversion for `blocks_to_str()`, with the same interface: repeatedly
+ * divide by the largest power of the base that fits in a block, and split each
+ * remainder into digits with single block arithmetic.
+ */
+static size_t to_str_basecase(StrSink* out, Block* x, int xn, size_t len,
+        const PowerTower* tower) {
+    int base = tower->base;
+    int chunk_digits = tower->chunk_digits;
+
+    // digits are produced least significant first, into the end of `digits`
+    size_t size = (size_t) (xn + 1) * (chunk_digits + 1);
+    char* digits = mem_alloc(size);
+    char* p = digits + size;
+    while (xn > 0) {
+        Block chunk = blocks_divrem_1_pre(x, x, xn, tower->chunk, tower->chunk_shift,
+                tower->chunk_inverse);
+        xn = blocks_normalized_size(x, xn);
+
+        // the most significant chunk has no leading zeros
+        char* chunk_end = p;
+        if (base == 10) {
+            // a constant divisor is turned into a multiplication
+            for (; chunk > 0 || (xn > 0 && chunk_end - p < chunk_digits); chunk /= 10) {
+                *--p = '0' + chunk % 10;
+            }
+        }
+        else {
+            for (; chunk > 0 || (xn > 0 && chunk_end - p < chunk_digits); chunk /= base) {
+                *--p = digit_chars[chunk % base];
+            }
+        }
+    }
+
+    size_t n = digits + size - p;
+    for (size_t zeros = len ? len - n : 0; zeros > 0;) {
+        size_t count = zeros < STR_BUFFER_SIZE ? zeros : STR_BUFFER_SIZE;
+        memset(sink_reserve(out, count), '0', count);
+        out->len += count;
+        zeros -= count;
+    }
+    sink_put(out, p, n);
+    mem_free(digits, size);
+
+    return len ? len : n;
+}
+
+/*
+ * Write the digits of `x`, which has `xn` blocks, to `out` in base `2^bits`,
+ * taking them straight from the bits of `x`. If `len` is nonzero exactly `len`
+ * digits are written, with leading zeros; otherwise only the significant digits
+ * are, and `x` must not be zero.
+ *
+ * Returns: The number of digits written.
+ */
+static size_t to_str_pow2(char* out, const Block* x, int xn, size_t len, int bits) {
+    size_t n = 0;
+    if (xn > 0) {
+        int64_t total_bits = (int64_t) xn * BLOCK_SIZE - block_clz(x[xn - 1]);
+        n = (size_t) ((total_bits + bits - 1) / bits);
+    }
+    if (len) {
+        memset(out, '0', len - n);
+        out += len - n;
+    }
+    if (n == 0) { return len; }
+    Block mask = ((Block) 1 << bits) - 1;
+
+    if (BLOCK_SIZE % bits == 0) {
+        // the top block has no leading zeros, all the others are written in full
+        int top_digits = (int) (n - (size_t) (xn - 1) * (BLOCK_SIZE / bits));
+        for (int shift = (top_digits - 1) * bits; shift >= 0; shift -= bits) {
+            *out++ = digit_chars[(x[xn - 1] >> shift) & mask];
+        }
+        int i = xn - 1;
+#if HEX_SIMD
+        if (bits == 4) {
+            size_t written = to_hex_simd(out, x, i);
+            out += written;
+            i -= (int) (written / (BLOCK_SIZE / 4));
+        }
+#endif
+        while (i-- > 0) {
+            for (int shift = BLOCK_SIZE - bits; shift >= 0; shift -= bits) {
+                *out++ = digit_chars[(x[i] >> shift) & mask];
+            }
+        }
+        return len ? len : n;
+    }
+
+    // digit i takes bits [i * bits, (i + 1) * bits), which may straddle two blocks
+    for (size_t i = 0; i < n; i++) {
+        int64_t bit = (int64_t) i * bits;
+        int64_t block = bit / BLOCK_SIZE;
+        int offset = (int) (bit % BLOCK_SIZE);
+        Block digit = x[block] >> offset;
+        if (offset + bits > BLOCK_SIZE && block + 1 < xn) {
+            digit |= x[block + 1] << (BLOCK_SIZE - offset);
+        }
+        out[n - 1 - i] = digit_chars[digit & mask];
+    }
+
+    return len ? len : n;
+}
+
+/*
+ * Make room for `n <= sink->size` more digits in `sink`, writing out what it holds
+ * if necessary. The caller stores the digits and adds `n` to `sink->len`.
+ *
+ * Returns: Where to store the digits.
+ */
+static char* sink_reserve(StrSink* sink, size_t n) {
+    if (sink->size - sink->len < n) { sink_flush(sink); }
+
+    return sink->buf + sink->len;
+}
+
+/*
+ * Append the `n` digits at `digits` to `sink`, writing it out as it fills up.
+ */
+static void sink_put(StrSink* sink, const char* digits, size_t n) {
+    while (n > 0) {
+        if (sink->len == sink->size) { sink_flush(sink); }
+        size_t count = sink->size - sink->len < n ? sink->size - sink->len : n;
+        memcpy(sink->buf + sink->len, digits, count);
+        sink->len += count;
+        digits += count;
+        n -= count;
+    }
+}
+
+/*
+ * Write out the digits in `sink` to its stream or file descriptor, and empty it.
+ * Once a write has failed, nothing more is written, but the digits are still
+ * discarded so that the conversion can finish.
+ */
+static void sink_flush(StrSink* sink) {
+    const char* p = sink->buf;
+    size_t n = sink->len;
+    sink->len = 0;
+    if (sink->error) { return; }
+
+    if (sink->file) {
+        if (fwrite(p, 1, n, sink->file) != n) { sink->error = 1; }
+        return;
+    }
+    while (n > 0) {
+        ssize_t written = write(sink->fd, p, n);
+        if (written < 0) {
+            if (errno == EINTR) { continue; }
+            sink->error = 1;
+            return;
+        }
+        p += written;
+        n -= written;
+    }
+}
+
+/*
+ * Convert the `len` digits at `str`, in the base of `tower`, to blocks in `x`,
+ * which must have room for `ceil(len / tower->chunk_digits)` blocks. The digits
+ * must have been validated.
+ *
+ * The string is split so that its low part has as many digits as the largest
+ * power in the tower that has fewer digits than the whole, both parts are
+ * converted recursively, and the high part is multiplied by the power and added
+ * to the low one. This is the inverse of `blocks_to_str()`.
+ *
+ * Returns: The number of blocks in `x`, normalized.
+ */
+static int blocks_from_str(Block* x, const char* str, size_t len, const PowerTower* tower) {
+    int chunk_digits = tower->chunk_digits;
+    int level = tower->num_levels - 1;
+    while (level >= 0 && tower->powers[level].digits >= len) { level--; }
+    if (len < (size_t) get_threshold(BNUM_FROM_STR_THRESHOLD) * chunk_digits || level < 0) {
+        return from_str_basecase(x, str, len, tower);
+    }
+
+    const StrPower* power = &tower->powers[level];
+    int pn = power->num_blocks;
+    size_t high_len = len - power->digits;
+    int high_capacity = (int) ((high_len + chunk_digits - 1) / chunk_digits);
+
+    // the low part fits in `x`, having at most as many blocks as the power
+    int size = 2 * high_capacity + pn;
+    Block* temp = temp_blocks(size);
+    Block* high = temp;
+    Block* product = high + high_capacity;
+    int hn = blocks_from_str(high, str, high_len, tower);
+    int ln = blocks_from_str(x, str + high_len, power->digits, tower);
+    if (hn == 0) {
+        free_temp_blocks(temp, size);
+        return ln;
+    }
+
+    if (hn >= pn) {
+        blocks_mul(product, high, hn, power->blocks, pn);
+    }
+    else {
+        blocks_mul(product, power->blocks, pn, high, hn);
+    }
+    blocks_add(x, product, hn + pn, x, ln);
+    free_temp_blocks(temp, size);
+
+    return blocks_normalized_size(x, hn + pn);
+}
+
+/*
+ * Schoolbook conversion for `blocks_from_str()`, with the same interface: read the
+ * digits in chunks that fit in a block, multiplying what has been read so far by
+ * the chunk before adding each one. The first chunk takes the digits left over,
+ * so that all the others are full.
+ */
+static int from_str_basecase(Block* x, const char* str, size_t len,
+        const PowerTower* tower) {
+    int base = tower->base;
+    int chunk_digits = tower->chunk_digits;
+    Block chunk = tower->chunk >> tower->chunk_shift;
+
+    int n = 0;
+    size_t i = 0;
+    size_t end = len % chunk_digits ? len % chunk_digits : (size_t) chunk_digits;
+    for (; i < len; end = i + chunk_digits) {
+        Block value = 0;
+        if (base == 10) {
+            for (; i < end; i++) { value = value * 10 + (str[i] - '0'); }
+        }
+        else {
+            for (; i < end; i++) { value = value * base + digit_value(str[i]); }
+        }
+
+        DBlock carry = value;
+        for (int j = 0; j < n; j++) {
+            carry += (DBlock) x[j] * chunk;
+            x[j] = (Block) carry;
+            carry >>= BLOCK_SIZE;
+        }
+        if (carry) { x[n++] = (Block) carry; }
+    }
+
+    return n;
+}
+
+/*
+ * Pack the `len` digits at `str`, in base `2^bits`, straight into the bits of
+ * `x`, which must have room for `ceil(len * bits / BLOCK_SIZE)` blocks, checking
+ * that they are digits of the base along the way.
+ *
+ * Returns: The number of blocks in `x`, normalized, or -1 if a character isn't a
+ *          digit.
+ */
+static int from_str_pow2(Block* x, const char* str, size_t len, int bits) {
+    int n = 0;
+    int invalid = 0;    // nonzero once a digit of `base` or more has been seen
+
+    if (BLOCK_SIZE % bits == 0) {
+        // whole blocks from the least significant end of the string
+        size_t block_digits = BLOCK_SIZE / bits;
+#if HEX_SIMD
+        if (bits == 4) {
+            n = from_hex_simd(x, str, len, &invalid);
+            len -= (size_t) n * block_digits;
+        }
+#endif
+        for (; len >= block_digits; len -= block_digits) {
+            const char* p = str + len - block_digits;
+            Block block = 0;
+            for (size_t j = 0; j < block_digits; j++) {
+                int digit = digit_value(p[j]);
+                invalid |= digit >> bits;
+                block = block << bits | digit;
+            }
+            x[n++] = block;
+        }
+    }
+
+    // least significant digit first; a digit may straddle two blocks
+    Block block = 0;
+    int filled = 0;
+    for (size_t i = len; i-- > 0;) {
+        Block digit = digit_value(str[i]);
+        invalid |= digit >> bits;
+        block |= digit << filled;
+        filled += bits;
+        if (filled >= BLOCK_SIZE) {
+            x[n++] = block;
+            filled -= BLOCK_SIZE;
+            block = filled ? digit >> (bits - filled) : 0;
+        }
+    }
+    if (filled) { x[n++] = block; }
+    if (invalid) { return -1; }
+
+    return blocks_normalized_size(x, n);
+}
+
+#if HEX_SIMD
+/*
+ * Write the `n` blocks of `x` to `out` in hexadecimal, most significant first and
+ * with leading zeros, 16 bytes at a time, as far as whole groups of 16 bytes go
+ * from the top. The blocks below are left for the caller.
+ *
+ * Returns: The number of digits written.
+ */
+static size_t to_hex_simd(char* out, const Block* x, int n) {
+    const unsigned char* bytes = (const unsigned char*) x;
+    size_t size = (size_t) n * sizeof(Block);
+    const __m128i chars = _mm_loadu_si128((const __m128i*) digit_chars);
+    const __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i low_nibbles = _mm_set1_epi8(0x0f);
+
+    size_t written = 0;
+    for (; size >= 16; size -= 16) {
+        // most significant byte first, then each byte as its high and low nibble
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (bytes + size - 16)), reverse);
+        __m128i high = _mm_and_si128(_mm_srli_epi16(v, 4), low_nibbles);
+        __m128i low = _mm_and_si128(v, low_nibbles);
+        __m128i first = _mm_unpacklo_epi8(high, low);
+        __m128i second = _mm_unpackhi_epi8(high, low);
+        _mm_storeu_si128((__m128i*) (out + written), _mm_shuffle_epi8(chars, first));
+        _mm_storeu_si128((__m128i*) (out + written + 16), _mm_shuffle_epi8(chars, second));
+        written += 32;
+    }
+
+    return written;
+}
+
+/*
+ * Convert hexadecimal digits to whole blocks of `x`, from the least significant
+ * end of the `len` digits at `str`, 16 digits at a time. Digits left over at the
+ * most significant end, fewer than 16, are left for the caller. `invalid` is set
+ * to nonzero if a character isn't a hexadecimal digit.
+ *
+ * Returns: The number of blocks written.
+ */
+static int from_hex_simd(Block* x, const char* str, size_t len, int* invalid) {
+    unsigned char* bytes = (unsigned char*) x;
+    const __m128i reverse = _mm_set_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 0, 1, 2, 3, 4, 5, 6, 7);
+    const __m128i pair_weights = _mm_set1_epi16(0x0110);  // high nibble * 16 + low
+    __m128i bad = _mm_setzero_si128();
+
+    size_t groups = len / 16;
+    for (size_t k = 0; k < groups; k++) {
+        __m128i c = _mm_loadu_si128((const __m128i*) (str + len - 16 * (k + 1)));
+
+        // bytes of 0x80 and up compare as negative, so they fail both ranges
+        __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+        __m128i is_digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+        __m128i is_letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+        bad = _mm_or_si128(bad, _mm_xor_si128(_mm_or_si128(is_digit, is_letter),
+                _mm_set1_epi8(-1)));
+
+        __m128i value = _mm_or_si128(
+                _mm_and_si128(is_digit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+                _mm_and_si128(is_letter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+        __m128i packed = _mm_packus_epi16(_mm_maddubs_epi16(value, pair_weights),
+                _mm_setzero_si128());
+        _mm_storel_epi64((__m128i*) (bytes + 8 * k), _mm_shuffle_epi8(packed, reverse));
+    }
+    *invalid |= _mm_movemask_epi8(bad);
+
+    return (int) (groups * 8 / sizeof(Block));
+}
+#endif
+
+/*
+ * Get the number of digits of base `base` that always fit in a block, i.e. the
+ * largest k with `base^k <= 2^BLOCK_SIZE - 1`.
+ */
+static int digits_per_block(int base) {
+    int digits = 1;
+    for (Block chunk = base; chunk <= BLOCK_MASK / base; chunk *= base) { digits++; }
+
+    return digits;
+}
+
+/*
+ * Get the value of the digit `c`, with letters in either case standing for 10 to
+ * 35, or 36 if `c` isn't a digit of any base.
+ */
+static int digit_value(char c) {
+    return digit_values[(unsigned char) c];
+}
+
+/*
+ * Check a header written by `Bnum_write()` and extract its fields.
+ *
+ * Parameters:  header      The FILE_HEADER_SIZE bytes of the header.
+ *              block_bits  Where to store the block width in bits.
+ *              big_endian  Where to store whether the data is big endian.
+ *              num_blocks  Where to store the number of blocks.
+ *
+ * Returns: 0 if the header is valid, -1 otherwise.
+ */
+static int decode_header(const unsigned char* header, int* block_bits, int* big_endian,
+        uint64_t* num_blocks) {
+    if (memcmp(header, FILE_MAGIC, 4) != 0 || header[4] != FILE_VERSION
+            || (header[5] != 32 && header[5] != 64) || header[6] > 1 || header[7] != 0) {
+        return -1;
+    }
+    *block_bits = header[5];
+    *big_endian = header[6];
+
+    unsigned char length[8];
+    memcpy(length, header + 8, 8);
+    if (*big_endian != HOST_BIG_ENDIAN) { swap_bytes(length, 8, 8); }
+    memcpy(num_blocks, length, 8);
+
+    // the number must fit in a Bnum of this machine
+    uint64_t bytes_max = (uint64_t) INT32_MAX * sizeof(Block);
+    return *num_blocks <= bytes_max / (*block_bits / 8) ? 0 : -1;
+}
+
+/*
+ * Reverse the order of the bytes within each `width` byte word of `data`, which
+ * has `size` bytes.
+ */
+static void swap_bytes(unsigned char* data, size_t size, size_t width) {
+    for (size_t i = 0; i + width <= size; i += width) {
+        for (size_t j = 0; j < width / 2; j++) {
+            unsigned char byte = data[i + j];
+            data[i + j] = data[i + width - 1 - j];
+            data[i + width - 1 - j] = byte;
+        }
+    }
+}
+
+
+/* ---------- Number Theoretic Transform ---------- */
+
+/*
+ * Large products are computed as cyclic convolutions of their 32-bit digits, using
+ * number theoretic transforms modulo three primes below 2^31 and combining the
+ * results with the Chinese remainder theorem. Each coefficient of the convolution
+ * is less than n * 2^64 for transform length n <= 2^NTT_MAX_LOG, which is less
+ * than the product of the primes (about 2^90.5), so all arithmetic is exact.
+ *
+ * Residues are kept in normal form, while twiddle factors are stored in
+ * Montgomery form (times 2^32 mod p), so that a Montgomery multiplication by a
+ * twiddle factor yields a normal product.
+ */
+
+#define NTT_P1 2013265921 // 15 * 2^27 + 1
+#define NTT_P2 1811939329 // 27 * 2^26 + 1
+#define NTT_P3 469762049  // 7 * 2^26 + 1
+#define NTT_P1_INV_P2 1811939320ULL     // P1^-1 mod P2
+#define NTT_P12_INV_P3 60252089ULL      // (P1 * P2)^-1 mod P3
+#define NTT_P12_HI 849346560ULL         // (P1 * P2) >> 32
+#define NTT_P12_LO 3825205249ULL        // (P1 * P2) & (2^32 - 1)
+#define NTT_MAX_LOG 26                  // largest transform length is 2^26
+#define NTT_LEAF 4096                   // transforms this short fit in L1 cache
+#define DIGIT_MASK 4294967295ULL        // 2^32 - 1
+#define DIGITS_PER_BLOCK (BLOCK_SIZE / 32)
+
+#define NTT_CRT_PIECES 64              // most pieces `ntt_crt()` is split into
+#define CARRY_BLOCKS ((95 + BLOCK_SIZE) / BLOCK_SIZE) // blocks of a 96-bit carry
+
+// A prime modulus together with its Montgomery constants.
+typedef struct NttPrime {
+    uint32_t p;
+    uint32_t p_inv;     // -p^-1 mod 2^32
+    uint32_t r;         // 2^32 mod p
+    uint32_t r2;        // 2^64 mod p
+    uint32_t root;      // a primitive root mod p
+} NttPrime;
+
+// The work `ntt_mul()` does for one of the primes: transforming the operands
+// and multiplying them pointwise into `residues`, with `3n` words of `scratch`.
+typedef struct NttPrimeTask {
+    Task task;
+    uint32_t p;
+    uint32_t root;
+    uint32_t* residues;
+    uint32_t* scratch;
+    const Block* a;
+    int an;
+    const Block* b;
+    int bn;
+    int n;
+} NttPrimeTask;
+
+// Half of a transform split off by `ntt_forward()` or `ntt_inverse()`.
+typedef struct NttHalfTask {
+    Task task;
+    uint32_t* x;
+    int n;
+    const uint32_t* roots;
+    const NttPrime* f;
+} NttHalfTask;
+
+// A range of 32-bit digits `[start, end)` for `ntt_crt_range()`, which leaves the
+// carry out of the range in `carry`.
+typedef struct NttCrtTask {
+    Task task;
+    Block* r;
+    const uint32_t* residues[3];
+    int start;
+    int end;
+    Block carry[CARRY_BLOCKS];
+} NttCrtTask;
+
+static void ntt_prime_init(NttPrime*, uint32_t, uint32_t);
+static uint32_t ntt_pow(uint32_t, uint64_t, uint32_t);
+static void ntt_roots(uint32_t*, uint32_t, int, const NttPrime*);
+static void ntt_load(uint32_t*, const Block*, int, int, const NttPrime*);
+static void ntt_forward(uint32_t*, int, const uint32_t*, const NttPrime*);
+static void ntt_inverse(uint32_t*, int, const uint32_t*, const NttPrime*);
+static void ntt_crt(Block*, int, const uint32_t*, const uint32_t*, const uint32_t*);
+static void ntt_crt_range(Block*, int, int, const uint32_t* const*, Block*);
+static void ntt_prime_task_run(Task*);
+static void ntt_forward_task_run(Task*);
+static void ntt_inverse_task_run(Task*);
+static void ntt_crt_task_run(Task*);
+
+/*
+ * The modular arithmetic below keeps values in [0, p) with branch-free
+ * corrections: for `x < 2 * p`, `min(x, x - p)` is `x mod p`, since `x - p`
+ * wraps around to a huge value when `x < p`. This lets the butterfly loops
+ * vectorize.
+ */
+static inline uint32_t min_u32(uint32_t a, uint32_t b) {
+    return a < b ? a : b;
+}
+
+/*
+ * Montgomery reduction: compute `x / 2^32 mod p` for `x < p * 2^32`.
+ */
+static inline uint32_t mont_reduce(uint64_t x, const NttPrime* f) {
+    uint32_t m = (uint32_t) x * f->p_inv;
+    uint32_t t = (x + (uint64_t) m * f->p) >> 32;
+    return min_u32(t, t - f->p);
+}
+
+static inline uint32_t mont_mul(uint32_t a, uint32_t b, const NttPrime* f) {
+    return mont_reduce((uint64_t) a * b, f);
+}
+
+static inline uint32_t mod_add(uint32_t a, uint32_t b, const NttPrime* f) {
+    uint32_t s = a + b;
+    return min_u32(s, s - f->p);
+}
+
+static inline uint32_t mod_sub(uint32_t a, uint32_t b, const NttPrime* f) {
+    uint32_t d = a - b;
+    return min_u32(d, d + f->p);
+}
+
+/*
+ * Determine whether `ntt_mul()` can compute the product of an `an` block number
+ * and a `bn` block number, i.e. whether the transform would be short enough.
+ */
+static int ntt_fits(int an, int bn) {
+    return (int64_t) (an + bn) * DIGITS_PER_BLOCK <= ((int64_t) 1 << NTT_MAX_LOG);
+}
+
+/*
+ * Compute `r = a * b` with number theoretic transforms, where `a` has `an` blocks
+ * and `b` has `bn` blocks. If `a` and `b` are the same array, only one forward
+ * transform per prime is needed. `r` must have room for `an + bn` blocks and must
+ * not overlap either input; `ntt_fits()` must hold for the operand sizes.
+ */
+static void ntt_mul(Block* r, const Block* a, int an, const Block* b, int bn) {
+    static const uint32_t primes[3][2] = { { NTT_P1, 31 }, { NTT_P2, 13 }, { NTT_P3, 3 } };
+    int digits = (an + bn) * DIGITS_PER_BLOCK;
+    int n = 2;
+    while (n < digits) { n *= 2; }
+
+    // the primes are independent; in parallel, each needs scratch space of its own
+    int parallel = use_threads(an + bn);
+    size_t size = (size_t) (parallel ? 12 : 6) * n * sizeof(uint32_t);
+    uint32_t* residues = scratch_alloc(size);
+    NttPrimeTask prime_tasks[3];
+    Task* tasks[3];
+
+    for (int i = 0; i < 3; i++) {
+        size_t scratch = 3 + (parallel ? 3 * i : 0);
+        prime_tasks[i] = (NttPrimeTask) { TASK_INIT(ntt_prime_task_run), primes[i][0], primes[i][1],
+            residues + i * (size_t) n, residues + scratch * n, a, an, b, bn, n };
+        tasks[i] = &prime_tasks[i].task;
+    }
+    run_tasks(tasks, 3, parallel);
+
+    ntt_crt(r, an + bn, residues, residues + n, residues + 2 * (size_t) n);
+    scratch_free(residues, size);
+}
+
+/*
+ * Run an `NttPrimeTask`: compute the cyclic convolution of the operands mod one
+ * prime.
+ */
+static void ntt_prime_task_run(Task* task) {
+    NttPrimeTask* t = (NttPrimeTask*) task;
+    int n = t->n;
+    uint32_t* fa = t->residues;
+    uint32_t* fb = t->scratch;
+    uint32_t* roots = fb + n;
+    uint32_t* inverse_roots = roots + n;
+
+    NttPrime f;
+    ntt_prime_init(&f, t->p, t->root);
+    uint32_t w = ntt_pow(f.root, (f.p - 1) / n, f.p);
+    ntt_roots(roots, w, n, &f);
+    ntt_roots(inverse_roots, ntt_pow(w, f.p - 2, f.p), n, &f);
+
+    ntt_load(fa, t->a, t->an, n, &f);
+    ntt_forward(fa, n, roots, &f);
+    const uint32_t* other = fa;
+    if (t->a != t->b) {
+        ntt_load(fb, t->b, t->bn, n, &f);
+        ntt_forward(fb, n, roots, &f);
+        other = fb;
+    }
+
+    // pointwise product, scaled by 1/n (in Montgomery form, to cancel out the
+    // extra 1/2^32 from the product as well)
+    uint32_t scale = (uint64_t) ntt_pow(n, f.p - 2, f.p) * f.r2 % f.p;
+    for (int j = 0; j < n; j++) {
+        fa[j] = mont_mul(mont_mul(fa[j], other[j], &f), scale, &f);
+    }
+
+    ntt_inverse(fa, n, inverse_roots, &f);
+}
+
+/*
+ * Set up the Montgomery constants for prime `p` with primitive root `root`.
+ */
+static void ntt_prime_init(NttPrime* f, uint32_t p, uint32_t root) {
+    uint32_t inv = p; // p * p = 1 mod 8, then each step doubles the correct bits
+    for (int i = 0; i < 4; i++) { inv *= 2 - p * inv; }
+
+    f->p = p;
+    f->p_inv = -inv;
+    f->r = ((uint64_t) 1 << 32) % p;
+    f->r2 = (uint64_t) f->r * f->r % p;
+    f->root = root;
+}
+
+/*
+ * Compute `base^e mod p` (normal form, not Montgomery).
+ */
+static uint32_t ntt_pow(uint32_t base, uint64_t e, uint32_t p) {
+    uint64_t result = 1;
+    uint64_t b = base % p;
+
+    for (; e > 0; e >>= 1) {
+        if (e & 1) { result = result * b % p; }
+        b = b * b % p;
+    }
+
+    return result;
+}
+
+/*
+ * Fill in the twiddle factors for transforms of length up to `n`, given a
+ * primitive `n`-th root of unity `w`. For each power of two `m <= n`, the powers
+ * of the `m`-th root of unity `w_m^j`, `0 <= j < m / 2`, are stored in Montgomery
+ * form at `roots[m / 2 + j]`, so every butterfly stage reads its factors
+ * sequentially.
+ */
+static void ntt_roots(uint32_t* roots, uint32_t w, int n, const NttPrime* f) {
+    uint32_t w_mont = (uint64_t) w * f->r % f->p;
+
+    roots[n / 2] = f->r;
+    for (int j = 1; j < n / 2; j++) {
+        roots[n / 2 + j] = mont_mul(roots[n / 2 + j - 1], w_mont, f);
+    }
+    for (int m = n / 2; m >= 2; m /= 2) {
+        for (int j = 0; j < m / 2; j++) { roots[m / 2 + j] = roots[m + 2 * j]; }
+    }
+}
+
+/*
+ * Split `x`, which has `xn` blocks, into 32-bit digits reduced mod p, padded with
+ * zeros to length `n`.
+ */
+static void ntt_load(uint32_t* digits, const Block* x, int xn, int n, const NttPrime* f) {
+    int xd = xn * DIGITS_PER_BLOCK;
+
+    for (int j = 0; j < xd; j++) {
+        uint32_t digit = (uint32_t) (x[j / DIGITS_PER_BLOCK] >> (32 * (j % DIGITS_PER_BLOCK)));
+        digits[j] = mont_mul(digit, f->r, f);
+    }
+    memset(digits + xd, 0, (n - xd) * sizeof(uint32_t));
+}
+
+/*
+ * Forward transform of length `n` (decimation in frequency): takes its input in
+ * natural order and leaves the output in bit-reversed order. Transforms longer
+ * than `NTT_LEAF` do their first stage over the whole array and then recurse into
+ * the two halves, so the later stages run on blocks that stay in cache.
+ */
+static void ntt_forward(uint32_t* x, int n, const uint32_t* roots, const NttPrime* f) {
+    int half = n / 2;
+
+    if (n > NTT_LEAF) {
+        for (int j = 0; j < half; j++) {
+            uint32_t u = x[j];
+            uint32_t v = x[j + half];
+            x[j] = mod_add(u, v, f);
+            x[j + half] = mont_mul(mod_sub(u, v, f), roots[half + j], f);
+        }
+        if (use_threads(n / DIGITS_PER_BLOCK)) {
+            NttHalfTask upper = { TASK_INIT(ntt_forward_task_run), x + half, half, roots, f };
+            task_spawn(&upper.task);
+            ntt_forward(x, half, roots, f);
+            task_wait(&upper.task);
+        }
+        else {
+            ntt_forward(x, half, roots, f);
+            ntt_forward(x + half, half, roots, f);
+        }
+        return;
+    }
+
+    for (; half >= 1; half /= 2) {
+        for (int start = 0; start < n; start += 2 * half) {
+            uint32_t* y = x + start;
+            for (int j = 0; j < half; j++) {
+                uint32_t u = y[j];
+                uint32_t v = y[j + half];
+                y[j] = mod_add(u, v, f);
+                y[j + half] = mont_mul(mod_sub(u, v, f), roots[half + j], f);
+            }
+        }
+    }
+}
+
+/*
+ * Inverse transform of length `n` (decimation in time), without the final
+ * scaling by 1/n: takes its input in bit-reversed order and leaves the output in
+ * natural order. `roots` must hold the twiddle factors of the inverse root of
+ * unity. Blocked the same way as `ntt_forward()`.
+ */
+static void ntt_inverse(uint32_t* x, int n, const uint32_t* roots, const NttPrime* f) {
+    int half = n / 2;
+
+    if (n > NTT_LEAF) {
+        if (use_threads(n / DIGITS_PER_BLOCK)) {
+            NttHalfTask upper = { TASK_INIT(ntt_inverse_task_run), x + half, half, roots, f };
+            task_spawn(&upper.task);
+            ntt_inverse(x, half, roots, f);
+            task_wait(&upper.task);
+        }
+        else {
+            ntt_inverse(x, half, roots, f);
+            ntt_inverse(x + half, half, roots, f);
+        }
+        for (int j = 0; j < half; j++) {
+            uint32_t u = x[j];
+            uint32_t v = mont_mul(x[j + half], roots[half + j], f);
+            x[j] = mod_add(u, v, f);
+            x[j + half] = mod_sub(u, v, f);
+        }
+        return;
+    }
+
+    for (half = 1; half < n; half *= 2) {
+        for (int start = 0; start < n; start += 2 * half) {
+            uint32_t* y = x + start;
+            for (int j = 0; j < half; j++) {
+                uint32_t u = y[j];
+                uint32_t v = mont_mul(y[j + half], roots[half + j], f);
+                y[j] = mod_add(u, v, f);
+                y[j + half] = mod_sub(u, v, f);
+            }
+        }
+    }
+}
+
+/*
+ * Run the half of a transform in an `NttHalfTask`.
+ */
+static void ntt_forward_task_run(Task* task) {
+    NttHalfTask* t = (NttHalfTask*) task;
+    ntt_forward(t->x, t->n, t->roots, t->f);
+}
+
+static void ntt_inverse_task_run(Task* task) {
+    NttHalfTask* t = (NttHalfTask*) task;
+    ntt_inverse(t->x, t->n, t->roots, t->f);
+}
+
+/*
+ * Recover each coefficient of the convolution from its residues mod the three
+ * primes (Garner's algorithm), and add the coefficients up at their 32-bit digit
+ * positions to form the `rn` block product `r`. In parallel, the digits are split
+ * into ranges that each start from a zero carry, and the carries out of the
+ * ranges are added in afterwards.
+ */
+static void ntt_crt(Block* r, int rn, const uint32_t* r1, const uint32_t* r2,
+        const uint32_t* r3) {
+    const uint32_t* residues[3] = { r1, r2, r3 };
+    int pieces = use_threads(rn) ? 4 * atomic_load(&current_ctx()->num_threads) : 1;
+    if (pieces > NTT_CRT_PIECES) { pieces = NTT_CRT_PIECES; }
+    if (pieces > rn / CARRY_BLOCKS) { pieces = 1; }
+    if (pieces == 1) {
+        Block carry[CARRY_BLOCKS];
+        ntt_crt_range(r, 0, rn * DIGITS_PER_BLOCK, residues, carry);
+        return;
+    }
+
+    NttCrtTask crt_tasks[NTT_CRT_PIECES];
+    Task* tasks[NTT_CRT_PIECES];
+    for (int i = 0; i < pieces; i++) {
+        crt_tasks[i] = (NttCrtTask) { TASK_INIT(ntt_crt_task_run), r, { r1, r2, r3 },
+            (int) ((int64_t) rn * i / pieces) * DIGITS_PER_BLOCK,
+            (int) ((int64_t) rn * (i + 1) / pieces) * DIGITS_PER_BLOCK, { 0 } };
+        tasks[i] = &crt_tasks[i].task;
+    }
+    run_tasks(tasks, pieces, 1);
+
+    // the product fits in `rn` blocks, so the last range has no carry out, and the
+    // others' carries never run past the end
+    for (int i = 0; i < pieces - 1; i++) {
+        int end = crt_tasks[i].end / DIGITS_PER_BLOCK;
+        blocks_add(r + end, r + end, rn - end, crt_tasks[i].carry, CARRY_BLOCKS);
+    }
+}
+
+/*
+ * Run an `NttCrtTask`.
+ */
+static void ntt_crt_task_run(Task* task) {
+    NttCrtTask* t = (NttCrtTask*) task;
+    ntt_crt_range(t->r, t->start, t->end, t->residues, t->carry);
+}
+
+/*
+ * Reconstruct the digits `[start, end)` of the product for `ntt_crt()`, starting
+ * from a zero carry; `start` and `end` must be multiples of DIGITS_PER_BLOCK. The
+ * carry out of the range is stored in `carry`.
+ */
+static void ntt_crt_range(Block* r, int start, int end, const uint32_t* const* residues,
+        Block* carry) {
+    const uint32_t* r1 = residues[0];
+    const uint32_t* r2 = residues[1];
+    const uint32_t* r3 = residues[2];
+    uint64_t carry0 = 0, carry1 = 0, carry2 = 0; // 32-bit digits of the carry
+
+    for (int i = start; i < end; i++) {
+        // coefficient = x1 + P1 * x2 + P1 * P2 * x3
+        uint64_t x1 = r1[i];
+        uint64_t x2 = (r2[i] + NTT_P2 - x1 % NTT_P2) % NTT_P2 * NTT_P1_INV_P2 % NTT_P2;
+        uint64_t low = x1 + NTT_P1 * x2;
+        uint64_t x3 = (r3[i] + NTT_P3 - low % NTT_P3) % NTT_P3 * NTT_P12_INV_P3 % NTT_P3;
+        uint64_t mid = NTT_P12_LO * x3;
+        uint64_t high = NTT_P12_HI * x3;
+
+        uint64_t d0 = carry0 + (low & DIGIT_MASK) + (mid & DIGIT_MASK);
+        uint64_t d1 = carry1 + (low >> 32) + (mid >> 32) + (high & DIGIT_MASK) + (d0 >> 32);
+        uint64_t d2 = carry2 + (high >> 32) + (d1 >> 32);
+        carry0 = d1 & DIGIT_MASK;
+        carry1 = d2 & DIGIT_MASK;
+        carry2 = d2 >> 32;
+
+        if (i % DIGITS_PER_BLOCK == 0) { r[i / DIGITS_PER_BLOCK] = 0; }
+        r[i / DIGITS_PER_BLOCK] |= (Block) (d0 & DIGIT_MASK) << (32 * (i % DIGITS_PER_BLOCK));
+    }
+
+    uint64_t digits[3] = { carry0, carry1, carry2 };
+    memset(carry, 0, CARRY_BLOCKS * sizeof(Block));
+    for (int i = 0; i < 3; i++) {
+        carry[i / DIGITS_PER_BLOCK] |= (Block) digits[i] << (32 * (i % DIGITS_PER_BLOCK));
+    }
 }
@@ -1,27 +1,140 @@
 #ifndef __BIG_NUMBERS_H__
 #define __BIG_NUMBERS_H__
 
-// Linked list of integers, representing "blocks" in positional notation.
-typedef struct Block {
-    uint32_t val;
-    struct Block* next;
-    struct Block* prev;
-} Block;
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Width of a block in bits. Define BNUM_BLOCK_BITS as 32 or 64 when building to
+// choose; 64-bit blocks are used by default wherever the compiler provides a 128-bit
+// integer type for the intermediate products, 32-bit blocks everywhere else.
+#ifndef BNUM_BLOCK_BITS
+#ifdef __SIZEOF_INT128__
+#define BNUM_BLOCK_BITS 64
+#else
+#define BNUM_BLOCK_BITS 32
+#endif
+#endif
+
+// A single "block" (digit) of a Bnum in positional notation, base 2^BNUM_BLOCK_BITS.
+#if BNUM_BLOCK_BITS == 64
+typedef uint64_t Block;
+#elif BNUM_BLOCK_BITS == 32
+typedef uint32_t Block;
+#else
+#error "BNUM_BLOCK_BITS must be 32 or 64"
+#endif
+
+// Divisor with precomputed data for dividing by it repeatedly; see
+// `Bnum_divisor_create()`.
+typedef struct Bnum_divisor Bnum_divisor;
+
+// Context for Montgomery multiplication modulo an odd number; see
+// `Bnum_mont_ctx_create()`.
+typedef struct Bnum_mont_ctx Bnum_mont_ctx;
+
+// Region that Bnums can be allocated from and then freed all at once; see
+// `Bnum_arena_begin()`.
+typedef struct Bnum_arena Bnum_arena;
+
+// Context holding the threads, scratch memory functions and tuning thresholds
+// heavy operations run with; see `Bnum_ctx_create()`.
+typedef struct Bnum_ctx Bnum_ctx;
+
+// Number of blocks (128 bits' worth) a Bnum stores inline, without allocating.
+#define BNUM_INLINE_BLOCKS (128 / BNUM_BLOCK_BITS)
 
 // Bnum - "Big number". Data structure used to store large numbers.
+// Blocks are stored contiguously, least significant first. The most significant
+// block is never zero, so the value zero has no blocks at all. Small values live
+// in `inline_blocks`, which `blocks` then points to, so a Bnum must not be copied
+// with a plain struct assignment; use `Bnum_set()` or `Bnum_swap()`.
 typedef struct Bnum {
-    int num_blocks;
-    Block* least_significant;
-    Block* most_significant;
+    int num_blocks;     // number of blocks in use
+    int capacity;       // number of blocks allocated
+    Block* blocks;
+    Bnum_arena* arena;  // arena the Bnum was allocated from, or NULL
+    Block inline_blocks[BNUM_INLINE_BLOCKS];
 } Bnum;
 
+// Tuning thresholds, in blocks, that decide which algorithm an operation uses.
+typedef enum Bnum_threshold {
+    BNUM_KARATSUBA_THRESHOLD,        // operands this size and up use Karatsuba multiplication
+    BNUM_TOOM33_THRESHOLD,           // balanced operands this size and up use Toom-3
+    BNUM_TOOM32_THRESHOLD,           // unbalanced operands this size and up use Toom-2.5/3.5
+    BNUM_SQR_KARATSUBA_THRESHOLD,    // squares this size and up use Karatsuba
+    BNUM_SQR_TOOM3_THRESHOLD,        // squares this size and up use Toom-3
+    BNUM_NTT_THRESHOLD,              // operands this size and up use transform multiplication
+    BNUM_DC_DIV_THRESHOLD,           // divisors this size and up use divide-and-conquer division
+    BNUM_NEWTON_DIV_THRESHOLD,       // divisors this size and up use Newton division for long quotients
+    BNUM_DIVISOR_NEWTON_THRESHOLD,   // divisor objects this size and up keep a Newton reciprocal
+    BNUM_TO_STR_THRESHOLD,           // numbers this size and up are converted to strings recursively
+    BNUM_FROM_STR_THRESHOLD,         // strings of this many blocks' worth of digits and up are parsed recursively
+    BNUM_PARALLEL_THRESHOLD,         // products this size and up are split across threads
+    BNUM_NUM_THRESHOLDS
+} Bnum_threshold;
+
+// Allocation counters of the calling thread, see `Bnum_get_alloc_stats()`.
+typedef struct Bnum_alloc_stats {
+    uint64_t heap_allocs;   // buffers obtained from malloc()
+    uint64_t heap_frees;    // buffers returned to free()
+    uint64_t pool_hits;     // allocations served from the thread's free lists
+    uint64_t arena_allocs;  // allocations served from an arena
+} Bnum_alloc_stats;
+
+// Memory allocation functions, see `Bnum_set_memory_functions()`. The free and
+// realloc functions are passed the size the memory was allocated with.
+typedef void* (*Bnum_alloc_func)(size_t size);
+typedef void* (*Bnum_realloc_func)(void* ptr, size_t old_size, size_t new_size);
+typedef void (*Bnum_free_func)(void* ptr, size_t size);
+
+// Executor hook of a context, see `Bnum_ctx_set_executor()`: arranges for
+// `job(arg)` to be called on some thread, passing along the `data` it was set with.
+typedef void (*Bnum_job_func)(void* arg);
+typedef void (*Bnum_submit_func)(Bnum_job_func job, void* arg, void* data);
+
 
 /* ---------- Library Functions ---------- */
 
+// Thread safety: any number of threads may run operations at once, as long as no
+// Bnum one of them modifies is used by another at the same time. Bnums, divisor
+// and Montgomery objects, and mapped numbers that are only read may be shared
+// freely. The exceptions are the functions that configure the library or a
+// context (memory functions, thresholds, thread counts, executors), which must not
+// run at the same time as operations they affect, and arenas, which belong to the
+// thread that began them. Caches are kept per thread; `Bnum_pool_trim()` frees
+// the calling thread's, and those of other threads are freed when they exit.
+
 // basic utilities
 Bnum* Bnum_create(uint64_t);
 void Bnum_destroy(Bnum*);
+void Bnum_init(Bnum*, uint64_t);
+void Bnum_clear(Bnum*);
 void Bnum_print(Bnum*);
+Bnum* Bnum_copy(Bnum*);
+void Bnum_set(Bnum*, Bnum*);
+void Bnum_set_u64(Bnum*, uint64_t);
+void Bnum_set_blocks(Bnum*, const Block*, int);
+void Bnum_swap(Bnum*, Bnum*);
+
+// string conversion
+size_t Bnum_str_size(Bnum*, int);
+char* Bnum_to_str(char*, int, Bnum*);
+Bnum* Bnum_from_str(const char*, size_t, int);
+char* Bnum_to_hex(char*, Bnum*);
+Bnum* Bnum_from_hex(const char*, size_t);
+int Bnum_fprint(FILE*, Bnum*, int);
+int Bnum_write_fd(int, Bnum*, int);
+
+// binary serialization
+int Bnum_write(FILE*, Bnum*);
+Bnum* Bnum_read(FILE*);
+Bnum* Bnum_map(const char*);
+void Bnum_unmap(Bnum*);
 
 // comparison operations
 int Bnum_eq(Bnum*, Bnum*);
@@ -33,7 +146,73 @@ int Bnum_gt(Bnum*, Bnum*);
 
 // arith operations
 Bnum* Bnum_sum(Bnum*, Bnum*);
+Bnum* Bnum_sub(Bnum*, Bnum*);
 Bnum* Bnum_mult(Bnum*, Bnum*);
+Bnum* Bnum_sqr(Bnum*);
 Bnum* Bnum_pow(Bnum*, int);
+Bnum* Bnum_div(Bnum*, Bnum*);
+Bnum* Bnum_mod(Bnum*, Bnum*);
+
+// arith operations into an existing Bnum (first argument); the destination may
+// also be one of the operands
+void Bnum_add_to(Bnum*, Bnum*, Bnum*);
+void Bnum_add_inplace(Bnum*, Bnum*);
+int Bnum_sub_to(Bnum*, Bnum*, Bnum*);
+int Bnum_sub_inplace(Bnum*, Bnum*);
+void Bnum_mul_to(Bnum*, Bnum*, Bnum*);
+void Bnum_mul_inplace(Bnum*, Bnum*);
+void Bnum_sqr_to(Bnum*, Bnum*);
+int Bnum_pow_to(Bnum*, Bnum*, int);
+int Bnum_divmod(Bnum*, Bnum*, Bnum*, Bnum*);
+
+// division by a precomputed divisor
+Bnum_divisor* Bnum_divisor_create(Bnum*);
+void Bnum_divisor_destroy(Bnum_divisor*);
+void Bnum_divmod_by(Bnum*, Bnum*, Bnum*, Bnum_divisor*);
+Bnum* Bnum_mod_by(Bnum*, Bnum_divisor*);
+
+// modular arithmetic
+Bnum* Bnum_powmod(Bnum*, Bnum*, Bnum*);
+int Bnum_powmod_to(Bnum*, Bnum*, Bnum*, Bnum*);
+Bnum_mont_ctx* Bnum_mont_ctx_create(Bnum*);
+void Bnum_mont_ctx_destroy(Bnum_mont_ctx*);
+void Bnum_to_mont(Bnum*, Bnum*, Bnum_mont_ctx*);
+void Bnum_from_mont(Bnum*, Bnum*, Bnum_mont_ctx*);
+void Bnum_mont_mul(Bnum*, Bnum*, Bnum*, Bnum_mont_ctx*);
+void Bnum_mont_sqr(Bnum*, Bnum*, Bnum_mont_ctx*);
+
+// tuning
+int Bnum_get_threshold(Bnum_threshold);
+void Bnum_set_threshold(Bnum_threshold, int);
+int Bnum_get_max_threads(void);
+void Bnum_set_max_threads(int);
+
+// contexts
+Bnum_ctx* Bnum_ctx_create(int);
+void Bnum_ctx_destroy(Bnum_ctx*);
+void Bnum_ctx_set_executor(Bnum_ctx*, Bnum_submit_func, void*);
+int Bnum_ctx_get_threshold(Bnum_ctx*, Bnum_threshold);
+void Bnum_ctx_set_threshold(Bnum_ctx*, Bnum_threshold, int);
+void Bnum_ctx_set_scratch_functions(Bnum_ctx*, Bnum_alloc_func, Bnum_free_func);
+void Bnum_mul_ctx(Bnum*, Bnum*, Bnum*, Bnum_ctx*);
+void Bnum_sqr_ctx(Bnum*, Bnum*, Bnum_ctx*);
+int Bnum_pow_ctx(Bnum*, Bnum*, int, Bnum_ctx*);
+int Bnum_divmod_ctx(Bnum*, Bnum*, Bnum*, Bnum*, Bnum_ctx*);
+int Bnum_powmod_ctx(Bnum*, Bnum*, Bnum*, Bnum*, Bnum_ctx*);
+char* Bnum_to_str_ctx(char*, int, Bnum*, Bnum_ctx*);
+Bnum* Bnum_from_str_ctx(const char*, size_t, int, Bnum_ctx*);
+
+// memory management
+Bnum_arena* Bnum_arena_begin(void);
+void Bnum_arena_release(Bnum_arena*);
+void Bnum_pool_trim(void);
+void Bnum_get_alloc_stats(Bnum_alloc_stats*);
+void Bnum_reset_alloc_stats(void);
+void Bnum_set_memory_functions(Bnum_alloc_func, Bnum_realloc_func, Bnum_free_func);
+void Bnum_get_memory_functions(Bnum_alloc_func*, Bnum_realloc_func*, Bnum_free_func*);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif // __BIG_NUMBERS_H__
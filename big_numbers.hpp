@@ -0,0 +1,434 @@
+/*
+ * File: big_numbers.hpp
+ *
+ * Fixed-width unsigned integers for C++, for numbers whose size is known at compile
+ * time, such as 256 to 4096-bit cryptographic operands. A `bnum::UInt<Bits>` keeps
+ * its blocks inline, so it never allocates, and every loop over them runs a
+ * compile-time number of times, which lets the compiler unroll short ones and keep
+ * the values in registers. The arithmetic wraps around modulo 2^Bits like the
+ * built-in unsigned types; `mul_wide()` gives the full product, and
+ * `bnum::Montgomery<Bits>` does modular multiplication and exponentiation.
+ *
+ * Values convert to and from Bnums, which needs libbnums.a; everything else is
+ * header-only. Requires C++14.
+ */
+
+#ifndef __BIG_NUMBERS_HPP__
+#define __BIG_NUMBERS_HPP__
+
+#include <stdint.h>
+#include "big_numbers.h"
+
+namespace bnum {
+
+// The inner loops over blocks are unrolled four times even at -O2, which unrolls
+// them completely for 256-bit numbers.
+#if defined(__GNUC__)
+#define BNUM_UNROLL _Pragma("GCC unroll 4")
+#else
+#define BNUM_UNROLL
+#endif
+
+// Double-width block type, for the intermediate products.
+#if BNUM_BLOCK_BITS == 64
+typedef unsigned __int128 DBlock;
+#else
+typedef uint64_t DBlock;
+#endif
+
+template <int Bits>
+struct UInt {
+    static_assert(Bits > 0 && Bits % BNUM_BLOCK_BITS == 0,
+            "the width of a UInt must be a positive multiple of BNUM_BLOCK_BITS");
+    static constexpr int num_blocks = Bits / BNUM_BLOCK_BITS;
+
+    Block blocks[num_blocks];   // least significant first
+
+    constexpr UInt() : blocks{} {}
+
+    constexpr UInt(uint64_t num) : blocks{} {
+        for (int i = 0; i < num_blocks && i * BNUM_BLOCK_BITS < 64; i++) {
+            blocks[i] = (Block) (num >> (i * BNUM_BLOCK_BITS));
+        }
+    }
+
+    /*
+     * Convert a Bnum, keeping only its low `Bits` bits if it is wider.
+     */
+    static UInt from_bnum(const Bnum* a) {
+        UInt result;
+        for (int i = 0; i < num_blocks && i < a->num_blocks; i++) { result.blocks[i] = a->blocks[i]; }
+        return result;
+    }
+
+    /*
+     * Store the value in `dst`.
+     */
+    void to_bnum(Bnum* dst) const { Bnum_set_blocks(dst, blocks, num_blocks); }
+
+    /*
+     * Return the value inside of a new Bnum, which should be destroyed by the caller.
+     */
+    Bnum* to_bnum() const {
+        Bnum* result = Bnum_create(0);
+        to_bnum(result);
+        return result;
+    }
+
+    constexpr bool bit(int i) const {
+        return (blocks[i / BNUM_BLOCK_BITS] >> (i % BNUM_BLOCK_BITS)) & 1;
+    }
+
+    constexpr bool is_zero() const {
+        Block any = 0;
+        for (int i = 0; i < num_blocks; i++) { any |= blocks[i]; }
+        return any == 0;
+    }
+
+    /*
+     * Return the number of bits up to and including the most significant 1 bit.
+     */
+    constexpr int bit_length() const {
+        for (int i = num_blocks - 1; i >= 0; i--) {
+            if (blocks[i]) {
+                int bits = i * BNUM_BLOCK_BITS;
+                for (Block top = blocks[i]; top; top >>= 1) { bits++; }
+                return bits;
+            }
+        }
+        return 0;
+    }
+};
+
+/* ---------- Block Loops ---------- */
+
+// These mirror the block array functions of big_numbers.c, with the length as a
+// template parameter.
+namespace detail {
+
+template <int N>
+constexpr Block add_n(Block* r, const Block* a, const Block* b) {
+    Block carry = 0;
+    BNUM_UNROLL
+    for (int i = 0; i < N; i++) {
+        Block sum = a[i] + carry;
+        carry = sum < carry;
+        r[i] = sum + b[i];
+        carry += r[i] < sum;
+    }
+    return carry;
+}
+
+template <int N>
+constexpr Block sub_n(Block* r, const Block* a, const Block* b) {
+    Block borrow = 0;
+    BNUM_UNROLL
+    for (int i = 0; i < N; i++) {
+        Block diff = a[i] - b[i];
+        Block next = (a[i] < b[i]) | (diff < borrow);
+        r[i] = diff - borrow;
+        borrow = next;
+    }
+    return borrow;
+}
+
+template <int N>
+constexpr Block addmul_1(Block* r, const Block* a, Block b) {
+    DBlock carry = 0;
+    BNUM_UNROLL
+    for (int i = 0; i < N; i++) {
+        carry += (DBlock) a[i] * b + r[i];
+        r[i] = (Block) carry;
+        carry >>= BNUM_BLOCK_BITS;
+    }
+    return (Block) carry;
+}
+
+template <int N>
+constexpr int cmp_n(const Block* a, const Block* b) {
+    for (int i = N - 1; i >= 0; i--) {
+        if (a[i] != b[i]) { return a[i] < b[i] ? -1 : 1; }
+    }
+    return 0;
+}
+
+/*
+ * Compute the `2N` block product `r = a * b`. `r` must not overlap the inputs.
+ */
+template <int N>
+constexpr void mul_n(Block* r, const Block* a, const Block* b) {
+    for (int i = 0; i < N; i++) { r[i] = 0; }
+    BNUM_UNROLL
+    for (int i = 0; i < N; i++) { r[N + i] = addmul_1<N>(r + i, a, b[i]); }
+}
+
+/*
+ * Compute the `2N` block square `r = a * a`, forming each cross product once and
+ * doubling them, like `blocks_sqr_basecase()`.
+ */
+template <int N>
+constexpr void sqr_n(Block* r, const Block* a) {
+    for (int i = 0; i < 2 * N; i++) { r[i] = 0; }
+    BNUM_UNROLL
+    for (int i = 0; i < N - 1; i++) {
+        DBlock carry = 0;
+        BNUM_UNROLL
+        for (int j = i + 1; j < N; j++) {
+            carry += (DBlock) a[i] * a[j] + r[i + j];
+            r[i + j] = (Block) carry;
+            carry >>= BNUM_BLOCK_BITS;
+        }
+        r[i + N] = (Block) carry;
+    }
+
+    DBlock carry = 0;
+    BNUM_UNROLL
+    for (int i = 0; i < N; i++) {
+        DBlock square = (DBlock) a[i] * a[i];
+        carry += ((DBlock) r[2 * i] << 1) + (Block) square;
+        r[2 * i] = (Block) carry;
+        carry >>= BNUM_BLOCK_BITS;
+        carry += ((DBlock) r[2 * i + 1] << 1) + (Block) (square >> BNUM_BLOCK_BITS);
+        r[2 * i + 1] = (Block) carry;
+        carry >>= BNUM_BLOCK_BITS;
+    }
+}
+
+} // namespace detail
+
+/* ---------- Arithmetic ---------- */
+
+/*
+ * Compute `r = a + b mod 2^Bits`. `r` may be the same as either operand.
+ *
+ * Returns: The carry out of the top block, 0 or 1.
+ */
+template <int Bits>
+constexpr Block add(UInt<Bits>& r, const UInt<Bits>& a, const UInt<Bits>& b) {
+    return detail::add_n<UInt<Bits>::num_blocks>(r.blocks, a.blocks, b.blocks);
+}
+
+/*
+ * Compute `r = a - b mod 2^Bits`. `r` may be the same as either operand.
+ *
+ * Returns: The borrow out of the top block, 1 if `a < b` and 0 otherwise.
+ */
+template <int Bits>
+constexpr Block sub(UInt<Bits>& r, const UInt<Bits>& a, const UInt<Bits>& b) {
+    return detail::sub_n<UInt<Bits>::num_blocks>(r.blocks, a.blocks, b.blocks);
+}
+
+/*
+ * Return the full product `a * b`, which is twice as wide as the operands.
+ */
+template <int Bits>
+constexpr UInt<2 * Bits> mul_wide(const UInt<Bits>& a, const UInt<Bits>& b) {
+    UInt<2 * Bits> result;
+    detail::mul_n<UInt<Bits>::num_blocks>(result.blocks, a.blocks, b.blocks);
+    return result;
+}
+
+/*
+ * Return the full square `a * a`; faster than `mul_wide(a, a)`.
+ */
+template <int Bits>
+constexpr UInt<2 * Bits> sqr_wide(const UInt<Bits>& a) {
+    UInt<2 * Bits> result;
+    detail::sqr_n<UInt<Bits>::num_blocks>(result.blocks, a.blocks);
+    return result;
+}
+
+/*
+ * Return -1, 0 or 1 as `a` is less than, equal to or greater than `b`.
+ */
+template <int Bits>
+constexpr int compare(const UInt<Bits>& a, const UInt<Bits>& b) {
+    return detail::cmp_n<UInt<Bits>::num_blocks>(a.blocks, b.blocks);
+}
+
+template <int Bits>
+constexpr UInt<Bits> operator+(const UInt<Bits>& a, const UInt<Bits>& b) {
+    UInt<Bits> result;
+    add(result, a, b);
+    return result;
+}
+
+template <int Bits>
+constexpr UInt<Bits> operator-(const UInt<Bits>& a, const UInt<Bits>& b) {
+    UInt<Bits> result;
+    sub(result, a, b);
+    return result;
+}
+
+// only the low half of the product is formed
+template <int Bits>
+constexpr UInt<Bits> operator*(const UInt<Bits>& a, const UInt<Bits>& b) {
+    constexpr int n = UInt<Bits>::num_blocks;
+    UInt<Bits> result;
+    for (int i = 0; i < n; i++) {
+        DBlock carry = 0;
+        BNUM_UNROLL
+        for (int j = 0; i + j < n; j++) {
+            carry += (DBlock) a.blocks[j] * b.blocks[i] + result.blocks[i + j];
+            result.blocks[i + j] = (Block) carry;
+            carry >>= BNUM_BLOCK_BITS;
+        }
+    }
+    return result;
+}
+
+template <int Bits>
+constexpr UInt<Bits>& operator+=(UInt<Bits>& a, const UInt<Bits>& b) { add(a, a, b); return a; }
+template <int Bits>
+constexpr UInt<Bits>& operator-=(UInt<Bits>& a, const UInt<Bits>& b) { sub(a, a, b); return a; }
+template <int Bits>
+constexpr UInt<Bits>& operator*=(UInt<Bits>& a, const UInt<Bits>& b) { return a = a * b; }
+
+template <int Bits>
+constexpr bool operator==(const UInt<Bits>& a, const UInt<Bits>& b) { return compare(a, b) == 0; }
+template <int Bits>
+constexpr bool operator!=(const UInt<Bits>& a, const UInt<Bits>& b) { return compare(a, b) != 0; }
+template <int Bits>
+constexpr bool operator<(const UInt<Bits>& a, const UInt<Bits>& b) { return compare(a, b) < 0; }
+template <int Bits>
+constexpr bool operator<=(const UInt<Bits>& a, const UInt<Bits>& b) { return compare(a, b) <= 0; }
+template <int Bits>
+constexpr bool operator>(const UInt<Bits>& a, const UInt<Bits>& b) { return compare(a, b) > 0; }
+template <int Bits>
+constexpr bool operator>=(const UInt<Bits>& a, const UInt<Bits>& b) { return compare(a, b) >= 0; }
+
+/* ---------- Montgomery Arithmetic ---------- */
+
+/*
+ * Montgomery multiplication modulo an odd `Bits`-bit number, like `Bnum_mont_ctx`.
+ * Numbers in Montgomery form are `a * R mod m` with `R = 2^Bits`; all arguments
+ * must be less than the modulus.
+ */
+template <int Bits>
+class Montgomery {
+public:
+    static constexpr int num_blocks = UInt<Bits>::num_blocks;
+
+    /*
+     * Create a context for the modulus `m`, which must be odd.
+     */
+    explicit Montgomery(const UInt<Bits>& mod) : m(mod) {
+        // -1 / m mod B: m is its own inverse mod 8, and each Newton step doubles
+        // the correct bits
+        Block inverse = m.blocks[0];
+        for (int bits = 3; bits < BNUM_BLOCK_BITS; bits *= 2) {
+            inverse *= 2 - m.blocks[0] * inverse;
+        }
+        minv = -inverse;
+
+        // R^2 mod m, by the library's division
+        Block r_squared[2 * num_blocks + 1] = {};
+        r_squared[2 * num_blocks] = 1;
+        Bnum* r = Bnum_create(0);
+        Bnum* mod_bnum = m.to_bnum();
+        Bnum_set_blocks(r, r_squared, 2 * num_blocks + 1);
+        Bnum_divmod(NULL, r, r, mod_bnum);
+        r2 = UInt<Bits>::from_bnum(r);
+        Bnum_destroy(r);
+        Bnum_destroy(mod_bnum);
+    }
+
+    const UInt<Bits>& modulus() const { return m; }
+
+    UInt<Bits> to_mont(const UInt<Bits>& a) const { return mul(a, r2); }
+
+    UInt<Bits> from_mont(const UInt<Bits>& a) const {
+        UInt<2 * Bits> t;
+        for (int i = 0; i < num_blocks; i++) { t.blocks[i] = a.blocks[i]; }
+        return redc(t);
+    }
+
+    /*
+     * Return `a * b / R mod m`, the Montgomery form of the product of two numbers in
+     * Montgomery form.
+     */
+    UInt<Bits> mul(const UInt<Bits>& a, const UInt<Bits>& b) const {
+        UInt<2 * Bits> product = mul_wide(a, b);
+        return redc(product);
+    }
+
+    UInt<Bits> sqr(const UInt<Bits>& a) const {
+        UInt<2 * Bits> square = sqr_wide(a);
+        return redc(square);
+    }
+
+    /*
+     * Return `a^e mod m`, with `a` and the result in normal form. The exponent is
+     * scanned in fixed windows of 4 bits, with a multiplication for every window,
+     * so the sequence of operations depends only on the length of `e`.
+     */
+    template <int ExpBits>
+    UInt<Bits> pow(const UInt<Bits>& a, const UInt<ExpBits>& e) const {
+        UInt<Bits> powers[16];
+        powers[0] = to_mont(UInt<Bits>(1));
+        powers[1] = to_mont(a);
+        for (int i = 2; i < 16; i++) { powers[i] = mul(powers[i - 1], powers[1]); }
+
+        UInt<Bits> result = powers[0];
+        for (int i = (e.bit_length() + 3) / 4 * 4 - 4; i >= 0; i -= 4) {
+            for (int j = 0; j < 4; j++) { result = sqr(result); }
+            int window = (e.blocks[i / BNUM_BLOCK_BITS] >> (i % BNUM_BLOCK_BITS)) & 15;
+            result = mul(result, powers[window]);
+        }
+
+        return from_mont(result);
+    }
+
+private:
+    UInt<Bits> m;       // the modulus
+    UInt<Bits> r2;      // R^2 mod m, for converting into Montgomery form
+    Block minv;         // -1 / m mod B, where B is the block base
+
+    /*
+     * Montgomery reduction: return `t / R mod m` for `t < m * R`, like `blocks_redc()`.
+     */
+    UInt<Bits> redc(UInt<2 * Bits>& t) const {
+        constexpr int n = num_blocks;
+        Block* w = t.blocks;
+
+        // each step zeroes the lowest block left in `t`, which then keeps the step's
+        // carry out of block `i + n` until they are all added in at the end; steps
+        // are taken two at a time, in one pass with a carry for each
+        int i = 0;
+        for (; i + 1 < n; i += 2, w += 2) {
+            Block u0 = w[0] * minv;
+            DBlock carry0 = ((DBlock) m.blocks[0] * u0 + w[0]) >> BNUM_BLOCK_BITS;
+            carry0 += (DBlock) m.blocks[1] * u0 + w[1];
+            w[1] = (Block) carry0;
+            carry0 >>= BNUM_BLOCK_BITS;
+
+            Block u1 = w[1] * minv;
+            DBlock carry1 = ((DBlock) m.blocks[0] * u1 + w[1]) >> BNUM_BLOCK_BITS;
+            BNUM_UNROLL
+            for (int k = 2; k < n; k++) {
+                carry0 += (DBlock) m.blocks[k] * u0 + w[k];
+                carry1 += (DBlock) m.blocks[k - 1] * u1 + (Block) carry0;
+                carry0 >>= BNUM_BLOCK_BITS;
+                w[k] = (Block) carry1;
+                carry1 >>= BNUM_BLOCK_BITS;
+            }
+            carry1 += (DBlock) m.blocks[n - 1] * u1 + w[n];
+            w[n] = (Block) carry1;
+
+            w[0] = (Block) carry0;
+            w[1] = (Block) (carry1 >> BNUM_BLOCK_BITS);
+        }
+        if (i < n) { w[0] = detail::addmul_1<n>(w, m.blocks, w[0] * minv); }
+
+        UInt<Bits> result;
+        Block carry = detail::add_n<n>(result.blocks, t.blocks + n, t.blocks);
+
+        // the result is less than 2m
+        if (carry || result >= m) { sub(result, result, m); }
+        return result;
+    }
+};
+
+} // namespace bnum
+
+#endif // __BIG_NUMBERS_HPP__
@@ -0,0 +1,265 @@
+/*
+ * File: thread_stress.c
+ *
+ * Stress test for the thread-safety guarantees documented in big_numbers.h. Runs
+ * every public operation from THREADS threads at once on their own Bnums, while
+ * all of them read a shared set of inputs: operands, a divisor, a Montgomery
+ * context, a mapped number and a Bnum_ctx. Multiplications are also split across
+ * 4 library worker threads, and the thresholds are lowered so that the
+ * Toom/NTT, divide-and-conquer string conversion and Newton division paths are
+ * all hit with small operands.
+ *
+ * Meant to be run under a sanitizer, see the `tsan` and `asan32` targets in the
+ * Makefile. Prints "ok" and exits with 0 when every check passed.
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "big_numbers.h"
+
+#define THREADS 8
+#define ITERATIONS 6
+
+#define CHECK(c) \
+    do { \
+        if (!(c)) { \
+            fprintf(stderr, "thread_stress.c:%d: check failed: %s\n", __LINE__, #c); \
+            __atomic_store_n(&failed, 1, __ATOMIC_RELAXED); \
+        } \
+    } while (0)
+
+static Bnum* random_bnum(int num_blocks, unsigned* seed);
+static void* worker(void* arg);
+
+// Shared between all threads, never written after setup.
+static Bnum *shared_a, *shared_b, *shared_mod, *mapped;
+static Bnum_divisor* shared_div;
+static Bnum_mont_ctx* shared_mont;
+static Bnum_ctx* shared_ctx;
+
+static int failed;
+
+int main(void) {
+    unsigned seed = 7;
+    char path[64];
+
+    shared_b = random_bnum(900, &seed);
+    shared_a = random_bnum(1800, &seed);
+    shared_mod = random_bnum(600, &seed);
+    shared_mod->blocks[0] |= 1;
+    shared_div = Bnum_divisor_create(shared_b);
+    shared_mont = Bnum_mont_ctx_create(shared_mod);
+
+    snprintf(path, sizeof(path), "/tmp/thread_stress_%d.bnum", (int) getpid());
+    FILE* f = fopen(path, "wb");
+    if (f == NULL || Bnum_write(f, shared_a) < 0) {
+        fprintf(stderr, "thread_stress.c: could not write %s\n", path);
+        return 1;
+    }
+    fclose(f);
+    mapped = Bnum_map(path);
+    CHECK(mapped != NULL);
+
+    Bnum_set_max_threads(4);
+    Bnum_set_threshold(BNUM_PARALLEL_THRESHOLD, 2);
+    Bnum_set_threshold(BNUM_NTT_THRESHOLD, 300);
+    Bnum_set_threshold(BNUM_TOOM33_THRESHOLD, 20);
+    Bnum_set_threshold(BNUM_TO_STR_THRESHOLD, 4);
+    Bnum_set_threshold(BNUM_FROM_STR_THRESHOLD, 4);
+    Bnum_set_threshold(BNUM_DIVISOR_NEWTON_THRESHOLD, 50);
+    shared_ctx = Bnum_ctx_create(3);
+
+    pthread_t threads[THREADS];
+    for (long i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, worker, (void*) (i + 1));
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    Bnum_ctx_destroy(shared_ctx);
+    Bnum_set_max_threads(1);
+    if (mapped != NULL) { Bnum_unmap(mapped); }
+    unlink(path);
+    Bnum_divisor_destroy(shared_div);
+    Bnum_mont_ctx_destroy(shared_mont);
+    Bnum_destroy(shared_a);
+    Bnum_destroy(shared_b);
+    Bnum_destroy(shared_mod);
+    Bnum_pool_trim();
+
+    puts(failed ? "FAIL" : "ok");
+    return failed;
+}
+
+/*
+ * random_bnum: Create a Bnum with `num_blocks` random blocks (the top one may
+ *              be 0, so the result can be shorter).
+ *
+ * Parameters:
+ *   - num_blocks: The number of blocks to generate.
+ *   - seed: State for rand_r, owned by the calling thread.
+ *
+ * Returns: A pointer to a new Bnum.
+ */
+static Bnum* random_bnum(int num_blocks, unsigned* seed) {
+    Block* blocks = malloc(num_blocks * sizeof(Block));
+    for (int i = 0; i < num_blocks; i++) {
+        blocks[i] = ((Block) rand_r(seed) << 31) ^ ((Block) rand_r(seed) << 7) ^ (Block) rand_r(seed);
+    }
+    Bnum* result = Bnum_create(0);
+    Bnum_set_blocks(result, blocks, num_blocks);
+    free(blocks);
+    return result;
+}
+
+/*
+ * worker: Body of each test thread. Exercises the whole public API on numbers
+ *         private to the thread, plus read-only use of the shared inputs.
+ *
+ * Parameters:
+ *   - arg: The thread's rand_r seed, cast to a pointer.
+ *
+ * Returns: NULL.
+ */
+static void* worker(void* arg) {
+    unsigned seed = (unsigned) (long) arg;
+
+    for (int it = 0; it < ITERATIONS; it++) {
+        int n = 1 + rand_r(&seed) % (it % 2 ? 2500 : 300);
+        Bnum* a = random_bnum(n, &seed);
+        Bnum* b = random_bnum(1 + n / 2, &seed);
+        Bnum* p = Bnum_mult(a, b);
+        Bnum* q = Bnum_create(0);
+        Bnum* r = Bnum_create(0);
+        Bnum* t = Bnum_create(0);
+
+        // Arithmetic and division
+        CHECK(Bnum_divmod(q, r, p, b) == 0 && Bnum_eq(q, a) && r->num_blocks == 0);
+        Bnum* d = Bnum_div(p, a);
+        CHECK(d != NULL && Bnum_eq(d, b));
+        Bnum_destroy(d);
+        Bnum* m = Bnum_mod(p, a);
+        CHECK(m != NULL && m->num_blocks == 0);
+        Bnum_destroy(m);
+        Bnum* s = Bnum_sum(p, a);
+        Bnum* u = Bnum_sub(s, a);
+        CHECK(Bnum_eq(u, p));
+        Bnum_destroy(s);
+        Bnum_destroy(u);
+        Bnum_sqr_to(t, a);
+        Bnum_mul_to(r, a, a);
+        CHECK(Bnum_eq(t, r));
+        CHECK(Bnum_pow_to(t, b, 3) == 0);
+        Bnum_mul_inplace(r, b);
+        Bnum_add_to(t, t, r);
+        CHECK(Bnum_sub_inplace(t, r) == 0);
+        Bnum* pw = Bnum_pow(b, 3);
+        CHECK(pw != NULL && Bnum_eq(t, pw));
+        Bnum_destroy(pw);
+
+        // Shared divisor and Montgomery context
+        Bnum* sp = Bnum_mult(shared_a, shared_b);
+        Bnum_divmod_by(q, r, sp, shared_div);
+        CHECK(Bnum_eq(q, shared_a) && r->num_blocks == 0);
+        Bnum_destroy(sp);
+        Bnum* mb = Bnum_mod_by(a, shared_div);
+        CHECK(Bnum_lt(mb, shared_b));
+        Bnum_destroy(mb);
+
+        Bnum* x = Bnum_create(0);
+        Bnum* y = Bnum_create(0);
+        Bnum* e = Bnum_create(65537);
+        Bnum_divmod(NULL, x, a, shared_mod);
+        Bnum_powmod_to(y, x, e, shared_mod);
+        Bnum_to_mont(t, x, shared_mont);
+        Bnum_mont_sqr(r, t, shared_mont);
+        Bnum_from_mont(r, r, shared_mont);
+        Bnum_mul_to(q, x, x);
+        Bnum_divmod(NULL, q, q, shared_mod);
+        CHECK(Bnum_eq(r, q));
+        Bnum_mont_mul(r, t, t, shared_mont);
+        Bnum_from_mont(r, r, shared_mont);
+        CHECK(Bnum_eq(r, q));
+        Bnum* pm = Bnum_powmod(x, e, shared_mod);
+        CHECK(pm != NULL && Bnum_eq(pm, y));
+        Bnum_destroy(pm);
+        Bnum_destroy(x);
+        Bnum_destroy(y);
+        Bnum_destroy(e);
+
+        // Comparisons against the mapped number
+        if (mapped != NULL) {
+            CHECK(Bnum_eq(mapped, shared_a) && Bnum_ge(mapped, shared_b));
+        }
+        CHECK(Bnum_le(shared_b, shared_a) && !Bnum_gt(shared_b, shared_a) && Bnum_ne(shared_a, shared_b));
+
+        // Strings, hexadecimal and I/O
+        int base = 2 + rand_r(&seed) % 35;
+        char* str = malloc(Bnum_str_size(p, base));
+        Bnum_to_str(str, base, p);
+        size_t len = strlen(str);
+        Bnum* back = Bnum_from_str(str, len, base);
+        CHECK(back != NULL && Bnum_eq(back, p));
+        Bnum_destroy(back);
+        char* hex = malloc(Bnum_str_size(p, 16));
+        Bnum_to_hex(hex, p);
+        back = Bnum_from_hex(hex, strlen(hex));
+        CHECK(back != NULL && Bnum_eq(back, p));
+        Bnum_destroy(back);
+
+        FILE* f = tmpfile();
+        CHECK(f != NULL);
+        if (f != NULL) {
+            CHECK(Bnum_fprint(f, p, base) == 0);
+            CHECK(Bnum_write(f, p) == 0);
+            rewind(f);
+            char* got = malloc(len + 1);
+            CHECK(fread(got, 1, len, f) == len && memcmp(got, str, len) == 0);
+            back = Bnum_read(f);
+            CHECK(back != NULL && Bnum_eq(back, p));
+            Bnum_destroy(back);
+            free(got);
+            fclose(f);
+        }
+        int fd = open("/dev/null", O_WRONLY);
+        CHECK(fd >= 0 && Bnum_write_fd(fd, p, base) == 0);
+        if (fd >= 0) { close(fd); }
+        free(str);
+        free(hex);
+
+        // Operations sharing one Bnum_ctx
+        Bnum_mul_ctx(t, a, b, shared_ctx);
+        CHECK(Bnum_eq(t, p));
+        Bnum_sqr_ctx(t, b, shared_ctx);
+        CHECK(Bnum_pow_ctx(r, b, 2, shared_ctx) == 0 && Bnum_eq(t, r));
+        CHECK(Bnum_divmod_ctx(q, r, p, a, shared_ctx) == 0 && Bnum_eq(q, b));
+
+        // Arenas, copies and the per-thread pool
+        Bnum_arena* arena = Bnum_arena_begin();
+        Bnum* c = Bnum_copy(p);
+        Bnum_add_inplace(c, c);
+        Bnum* h = Bnum_mult(c, c);
+        Bnum_swap(c, h);
+        Bnum_arena_release(arena);
+        Bnum_set(t, p);
+        Bnum_set_u64(r, 7);
+        Bnum_clear(r);
+        Bnum_init(r, 3);
+        Bnum_alloc_stats stats;
+        Bnum_get_alloc_stats(&stats);
+
+        Bnum_destroy(a);
+        Bnum_destroy(b);
+        Bnum_destroy(p);
+        Bnum_destroy(q);
+        Bnum_destroy(r);
+        Bnum_destroy(t);
+        if (it % 3 == 2) { Bnum_pool_trim(); }
+    }
+    return NULL;
+}